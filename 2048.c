@@ -6,33 +6,193 @@
  ============================================================================
  */
 
-#define _XOPEN_SOURCE 500 // for: usleep
+#define _XOPEN_SOURCE 600 // for: posix_memalign, fileno
+#include <arpa/inet.h>    // defines: htons, inet_pton
+#include <errno.h>        // defines: errno, EAGAIN, EWOULDBLOCK
+#include <fcntl.h>        // defines: open, fcntl, O_APPEND, O_NONBLOCK
+#include <getopt.h>       // defines: getopt_long
+#include <math.h>         // defines: pow, log, ceil, sqrt, INFINITY
+#include <netinet/in.h>   // defines: sockaddr_in
+#include <poll.h>         // defines: poll, POLLIN
+#include <pthread.h>      // defines: pthread_create, pthread_join
+#include <semaphore.h>    // defines: sem_init, sem_wait, sem_post
 #include <signal.h>       // defines: signal, SIGINT
 #include <stdbool.h>      // defines: true, false
 #include <stdint.h>       // defines: uint8_t, uint32_t
-#include <stdio.h>        // defines: printf, puts, getchar
-#include <stdlib.h>       // defines: EXIT_SUCCESS
-#include <string.h>       // defines: strcmp
-#include <sys/stat.h>     // defines: mkdir
+#include <stdio.h>        // defines: printf, puts
+#include <stdlib.h>       // defines: EXIT_SUCCESS, posix_memalign
+#include <string.h>       // defines: strcmp, memcmp
+#include <sys/socket.h>   // defines: socket, bind, listen, accept
+#include <sys/stat.h>     // defines: mkdir, fstat
+#include <sys/un.h>       // defines: sockaddr_un
 #include <termios.h>      // defines: termios, TCSANOW, ICANON, ECHO
 #include <time.h>         // defines: time
-#include <unistd.h>       // defines: STDIN_FILENO, usleep, getopt
+#include <unistd.h>       // defines: STDIN_FILENO, read, write, dup2, fsync, sysconf
 
-#define SIZE 4
+#include "lib2048.h"
+
+// With --profile the phases of play and batch mode are timed into histograms
+// with four buckets per power of two nanoseconds. Every thread has its own,
+// so that no thread ever waits for another, and they are added up when they
+// are printed to stderr: at the end and whenever the process gets SIGUSR1.
+// Without --profile timing a phase costs a test of profiling.
+enum phase {
+    PHASE_INPUT,
+    PHASE_THINK,
+    PHASE_MOVE,
+    PHASE_SPAWN,
+    PHASE_OVER,
+    PHASE_DRAW,
+    PHASE_STATE,
+    PHASES
+};
+const char *phase_names[PHASES] = {"input wait", "player",    "move",
+                                   "spawn",      "game over", "draw",
+                                   "state i/o"};
+#define PROFILE_BUCKETS 256
+
+struct profile {
+    uint64_t counts[PHASES][PROFILE_BUCKETS];
+    uint64_t max[PHASES];
+};
+
+bool profiling = false; // set by startProfiling
+// the one of the main thread, and those of the batch workers
+struct profile main_profile;
+struct profile *volatile thread_profiles = NULL;
+volatile uint32_t thread_profile_count = 0;
+
+uint64_t profileClock() {
+    struct timespec now;
+    if (!profiling) {
+        return 0;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+// the bucket of a time: its power of two and the two bits below the top one
+uint8_t profileBucket(uint64_t ns) {
+    uint8_t octave;
+    if (ns < 4) {
+        return ns;
+    }
+#ifdef __GNUC__
+    octave = 63 - __builtin_clzll(ns);
+#else
+    for (octave = 0; ns >> (octave + 1); octave++) {
+    }
+#endif
+    return octave << 2 | ((ns >> (octave - 2)) & 3);
+}
+
+// adds the time since start, from profileClock, to the phase
+void profilePhase(struct profile *profile, uint8_t phase, uint64_t start) {
+    uint64_t ns;
+    if (!profiling) {
+        return;
+    }
+    ns = profileClock() - start;
+    profile->counts[phase][profileBucket(ns)]++;
+    if (ns > profile->max[phase]) {
+        profile->max[phase] = ns;
+    }
+}
+
+// the highest time that falls in the bucket
+uint64_t bucketTime(uint16_t bucket) {
+    uint8_t octave = bucket >> 2;
+    if (bucket < 4) {
+        return bucket;
+    }
+    return ((4ULL + (bucket & 3) + 1) << (octave - 2)) - 1;
+}
+
+void printProfile() {
+    static struct profile total;
+    struct profile *profile;
+    uint64_t count, seen, p50, p99;
+    uint32_t t;
+    uint16_t b;
+    uint8_t p;
+    memcpy(&total, &main_profile, sizeof(total));
+    for (t = 0; t < thread_profile_count; t++) {
+        profile = &thread_profiles[t];
+        for (p = 0; p < PHASES; p++) {
+            for (b = 0; b < PROFILE_BUCKETS; b++) {
+                total.counts[p][b] += profile->counts[p][b];
+            }
+            if (profile->max[p] > total.max[p]) {
+                total.max[p] = profile->max[p];
+            }
+        }
+    }
+    fprintf(stderr, "%-10s %12s %10s %10s %10s\n", "phase", "count",
+            "p50 us", "p99 us", "max us");
+    for (p = 0; p < PHASES; p++) {
+        for (count = 0, b = 0; b < PROFILE_BUCKETS; b++) {
+            count += total.counts[p][b];
+        }
+        if (count == 0) {
+            continue;
+        }
+        p50 = p99 = 0;
+        for (seen = 0, b = 0; b < PROFILE_BUCKETS; b++) {
+            seen += total.counts[p][b];
+            if (p50 == 0 && seen * 2 >= count) {
+                p50 = bucketTime(b);
+            }
+            if (seen * 100 >= count * 99) {
+                p99 = bucketTime(b);
+                break;
+            }
+        }
+        // no time is above the highest one
+        p50 = p50 < total.max[p] ? p50 : total.max[p];
+        p99 = p99 < total.max[p] ? p99 : total.max[p];
+        fprintf(stderr, "%-10s %12llu %10.1f %10.1f %10.1f\n", phase_names[p],
+                (unsigned long long)count, p50 / 1e3, p99 / 1e3,
+                total.max[p] / 1e3);
+    }
+}
+
+// SIGUSR1 is blocked in every thread but this one, which prints the profile
+// outside of any signal handler
+void *runProfileSignals(void *arg) {
+    sigset_t *signals = arg;
+    int signum;
+    while (sigwait(signals, &signum) == 0) {
+        printProfile();
+    }
+    return NULL;
+}
+
+void startProfiling() {
+    static sigset_t signals;
+    pthread_t thread;
+    profiling = true;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    pthread_create(&thread, NULL, runProfileSignals, &signals);
+    pthread_detach(thread);
+    atexit(printProfile);
+}
 
 // this function receives 2 pointers (indicated by *) so it can set their values
 void getColors(uint8_t value, uint8_t scheme, uint8_t *foreground,
                uint8_t *background) {
-    uint8_t original[] = {8,   255, 1,   255, 2,   255, 3,   255, 4,   255, 5,
-        255, 6,   255, 7,   255, 9,   0,   10,  0,   11,  0,
-        12,  0,   13,  0,   14,  0,   255, 0,   255, 0};
-    uint8_t blackwhite[] = {232, 255, 234, 255, 236, 255, 238, 255, 240, 255, 242,
-        255, 244, 255, 246, 0,   248, 0,   249, 0,   250, 0,
-        251, 0,   252, 0,   253, 0,   254, 0,   255, 0};
-    uint8_t bluered[] = {235, 255, 63,  255, 57,  255, 93,  255, 129, 255, 165,
-        255, 201, 255, 200, 255, 199, 255, 198, 255, 197, 255,
-        196, 255, 196, 255, 196, 255, 196, 255, 196, 255};
-    uint8_t *schemes[] = {original, blackwhite, bluered};
+    static const uint8_t original[] = {
+        8, 255, 1, 255, 2, 255, 3, 255, 4, 255, 5, 255, 6, 255, 7, 255, 9, 0,
+        10, 0, 11, 0, 12, 0, 13, 0, 14, 0, 255, 0, 255, 0};
+    static const uint8_t blackwhite[] = {
+        232, 255, 234, 255, 236, 255, 238, 255, 240, 255, 242, 255, 244, 255,
+        246, 0, 248, 0, 249, 0, 250, 0, 251, 0, 252, 0, 253, 0, 254, 0, 255, 0};
+    static const uint8_t bluered[] = {
+        235, 255, 63, 255, 57, 255, 93, 255, 129, 255, 165, 255, 201, 255, 200,
+        255, 199, 255, 198, 255, 197, 255, 196, 255, 196, 255, 196, 255, 196,
+        255, 196, 255};
+    static const uint8_t *schemes[] = {original, blackwhite, bluered};
     // modify the 'pointed to' variables (using a * on the left hand of the
     // assignment)
     *foreground = *(schemes[scheme] + (1 + value * 2) % sizeof(original));
@@ -49,238 +209,285 @@ uint8_t getDigitCount(uint32_t number) {
     return count;
 }
 
-void drawBoard(uint8_t board[SIZE][SIZE], uint8_t scheme, uint32_t score) {
-    uint8_t x, y, fg, bg;
-    printf("\033[H"); // move cursor to 0,0
-    printf("2048.c %17d pts\n\n", score);
-    for (y = 0; y < SIZE; y++) {
-        for (x = 0; x < SIZE; x++) {
-            // send the addresses of the foreground and background variables,
-            // so that they can be modified by the getColors function
-            getColors(board[x][y], scheme, &fg, &bg);
-            printf("\033[1;38;5;%d;48;5;%dm", fg, bg); // set color
-            printf("       ");
-            printf("\033[m"); // reset all modes
-        }
-        printf("\n");
-        for (x = 0; x < SIZE; x++) {
-            getColors(board[x][y], scheme, &fg, &bg);
-            printf("\033[1;38;5;%d;48;5;%dm", fg, bg); // set color
-            if (board[x][y] != 0) {
-                uint32_t number = 1 << board[x][y];
-                uint8_t t = 7 - getDigitCount(number);
-                printf("%*s%u%*s", t - t / 2, "", number, t / 2, "");
+// A tile is drawn as three lines of 7 characters in its colors: a blank line,
+// the line with its number and another blank line. The strings for every
+// scheme and exponent are put together once, so that a frame only copies them.
+// The larger boards reach beyond the 32768 of the packed one, up to 7 digits.
+#define SCHEMES 3
+#define TILE_VALUES 24
+#define TILE_STRING 40
+char tile_blanks[SCHEMES][TILE_VALUES][TILE_STRING];
+char tile_numbers[SCHEMES][TILE_VALUES][TILE_STRING];
+
+void initTileStrings() {
+    uint8_t scheme, value, fg, bg, t;
+    uint32_t number;
+    char color[24];
+    for (scheme = 0; scheme < SCHEMES; scheme++) {
+        for (value = 0; value < TILE_VALUES; value++) {
+            getColors(value, scheme, &fg, &bg);
+            // set color, reset all modes after the tile
+            snprintf(color, sizeof(color), "\033[1;38;5;%d;48;5;%dm", fg, bg);
+            snprintf(tile_blanks[scheme][value], TILE_STRING,
+                     "%s       \033[m", color);
+            if (value != 0) {
+                number = 1 << value;
+                t = 7 - getDigitCount(number);
+                snprintf(tile_numbers[scheme][value], TILE_STRING,
+                         "%s%*s%u%*s\033[m", color, t - t / 2, "", number,
+                         t / 2, "");
             } else {
-                printf("   ·   ");
+                snprintf(tile_numbers[scheme][value], TILE_STRING,
+                         "%s   ·   \033[m", color);
             }
-            printf("\033[m"); // reset all modes
-        }
-        printf("\n");
-        for (x = 0; x < SIZE; x++) {
-            getColors(board[x][y], scheme, &fg, &bg);
-            printf("\033[1;38;5;%d;48;5;%dm", fg, bg); // set color
-            printf("       ");
-            printf("\033[m"); // reset all modes
         }
-        printf("\n");
     }
-    printf("\n");
-    printf("     ←,↑,→,↓,u,x or q       \n");
-    printf("\033[A"); // one line up
 }
 
-uint8_t findTarget(uint8_t array[SIZE], uint8_t x, uint8_t stop) {
-    uint8_t t;
-    // if the position is already on the first, don't evaluate
-    if (x == 0) {
-        return x;
-    }
-    for (t = x - 1;; t--) {
-        if (array[t] != 0) {
-            if (array[t] != array[x]) {
-                // merge is not possible, take next position
-                return t + 1;
-            }
-            return t;
-        } else {
-            // we should not slide further, return this one
-            if (t == stop) {
-                return t;
-            }
-        }
-    }
-    // we did not find a target
-    return x;
+// The frame is composed in one buffer and written with a single call, so the
+// terminal never shows half of it. In diff mode only the tiles that changed
+// since the last frame are sent, each after moving the cursor to it.
+struct screen {
+    char frame[16384]; // an 8x8 board takes about 6 KB
+    uint32_t length;
+    bool diff;
+    bool drawn; // board, score and scheme are what the terminal shows
+    board_t board;
+    uint32_t score;
+    uint32_t best; // the best score so far before this game
+    uint8_t scheme;
+};
+struct screen screen;
+
+void appendFrame(const char *text) {
+    uint32_t length = strlen(text);
+    memcpy(screen.frame + screen.length, text, length);
+    screen.length += length;
 }
 
-bool slideArray(uint8_t array[SIZE], uint32_t *score) {
-    bool success = false;
-    uint8_t x, t, stop = 0;
-
-    for (x = 0; x < SIZE; x++) {
-        if (array[x] != 0) {
-            t = findTarget(array, x, stop);
-            // if target is not original position, then move or merge
-            if (t != x) {
-                // if target is zero, this is a move
-                if (array[t] == 0) {
-                    array[t] = array[x];
-                } else if (array[t] == array[x]) {
-                    // merge (increase power of two)
-                    array[t]++;
-                    // increase score
-                    *score += (uint32_t)1 << array[t];
-                    // set stop to avoid double merge
-                    stop = t + 1;
-                }
-                array[x] = 0;
-                success = true;
-            }
+void writeFrame() {
+    uint32_t written = 0;
+    ssize_t result;
+    // what was printed since the last frame has to come out first
+    fflush(stdout);
+    while (written < screen.length) {
+        result = write(STDOUT_FILENO, screen.frame + written,
+                       screen.length - written);
+        if (result <= 0) {
+            break;
         }
+        written += result;
     }
-    return success;
+    screen.length = 0;
 }
 
-void rotateBoard(uint8_t board[SIZE][SIZE]) {
-    uint8_t i, j, n = SIZE;
-    uint8_t tmp;
-    for (i = 0; i < n / 2; i++) {
-        for (j = i; j < n - i - 1; j++) {
-            tmp = board[i][j];
-            board[i][j] = board[j][n - i - 1];
-            board[j][n - i - 1] = board[n - i - 1][n - j - 1];
-            board[n - i - 1][n - j - 1] = board[n - j - 1][i];
-            board[n - j - 1][i] = tmp;
+// The outcomes of the four moves of the board on the screen are worked out
+// when it is drawn, while the player still thinks: a key then only picks one,
+// and the footer greys out the directions that do not move the board.
+struct outcomes {
+    board_t board; // the one they are of
+    uint32_t score;
+    struct game next[4]; // without their rng, that the move does not change
+    uint8_t legal; // a bit per direction
+};
+struct outcomes outcomes;
+
+void predictMoves(struct outcomes *outcomes, board_t board, uint32_t score) {
+    uint8_t d;
+    outcomes->board = board;
+    outcomes->score = score;
+    outcomes->legal = 0;
+    for (d = UP; d <= RIGHT; d++) {
+        outcomes->next[d].board = board;
+        outcomes->next[d].score = score;
+        if (engineMove(&outcomes->next[d].board, d, &outcomes->next[d].score)) {
+            outcomes->legal |= 1 << d;
+            gameRefresh(&outcomes->next[d]);
         }
     }
 }
 
-bool moveUp(uint8_t board[SIZE][SIZE], uint32_t *score) {
-    bool success = false;
-    uint8_t x;
-    for (x = 0; x < SIZE; x++) {
-        success |= slideArray(board[x], score);
+// moves the game like gameMove, on the outcomes when they are of its board
+bool movePredicted(struct game *game, uint8_t direction) {
+    rng_t rng = game->rng;
+    if (outcomes.board != game->board || outcomes.score != game->score) {
+        predictMoves(&outcomes, game->board, game->score);
     }
-    return success;
-}
-
-bool moveLeft(uint8_t board[SIZE][SIZE], uint32_t *score) {
-    bool success;
-    rotateBoard(board);
-    success = moveUp(board, score);
-    rotateBoard(board);
-    rotateBoard(board);
-    rotateBoard(board);
-    return success;
-}
-
-bool moveDown(uint8_t board[SIZE][SIZE], uint32_t *score) {
-    bool success;
-    rotateBoard(board);
-    rotateBoard(board);
-    success = moveUp(board, score);
-    rotateBoard(board);
-    rotateBoard(board);
-    return success;
-}
-
-bool moveRight(uint8_t board[SIZE][SIZE], uint32_t *score) {
-    bool success;
-    rotateBoard(board);
-    rotateBoard(board);
-    rotateBoard(board);
-    success = moveUp(board, score);
-    rotateBoard(board);
-    return success;
+    if ((outcomes.legal & 1 << direction) == 0) {
+        return false;
+    }
+    *game = outcomes.next[direction];
+    game->rng = rng;
+    return true;
 }
 
-bool findPairDown(uint8_t board[SIZE][SIZE]) {
-    bool success = false;
-    uint8_t x, y;
-    for (x = 0; x < SIZE; x++) {
-        for (y = 0; y < SIZE - 1; y++) {
-            if (board[x][y] == board[x][y + 1])
-                return true;
+void drawBoard(board_t packed, uint8_t scheme, uint32_t score) {
+    static const uint8_t arrow_directions[] = {LEFT, UP, RIGHT, DOWN};
+    static const char *arrows[] = {"←", "↑", "→", "↓"};
+    uint8_t x, y, line, value, i;
+    bool full = !screen.diff || !screen.drawn || scheme != screen.scheme;
+    uint32_t best = score > screen.best ? score : screen.best;
+    char text[96];
+    uint64_t start = profileClock();
+    if (full || score != screen.score) {
+        snprintf(text, sizeof(text), "\033[H2048.c %17d pts\n   best %16u pts\n",
+                 score, best);
+        appendFrame(text); // move cursor to 0,0
+    }
+    for (y = 0; y < SIZE; y++) {
+        for (line = 0; line < 3; line++) {
+            for (x = 0; x < SIZE; x++) {
+                value = (packed >> (4 * (SIZE * x + y))) & 0xf;
+                if (!full) {
+                    if (value == ((screen.board >> (4 * (SIZE * x + y))) & 0xf)) {
+                        continue;
+                    }
+                    // the tiles start on the third line of the screen
+                    snprintf(text, sizeof(text), "\033[%d;%dH",
+                             3 + 3 * y + line, 1 + 7 * x);
+                    appendFrame(text);
+                }
+                appendFrame(line == 1 ? tile_numbers[scheme][value]
+                                      : tile_blanks[scheme][value]);
+            }
+            if (full) {
+                appendFrame("\n");
+            }
         }
     }
-    return success;
+    if (full) {
+        appendFrame("\n");
+    } else {
+        // messages are printed over the footer, so it is always redrawn
+        snprintf(text, sizeof(text), "\033[%d;1H", 4 + 3 * SIZE);
+        appendFrame(text);
+    }
+    predictMoves(&outcomes, packed, score);
+    appendFrame("     ");
+    for (i = 0; i < 4; i++) {
+        if ((outcomes.legal & 1 << arrow_directions[i]) == 0) {
+            appendFrame("\033[90m"); // grey
+        }
+        appendFrame(arrows[i]);
+        appendFrame("\033[m,");
+    }
+    appendFrame("u,x or q       \n");
+    appendFrame("\033[A"); // one line up
+    writeFrame();
+    screen.drawn = true;
+    screen.board = packed;
+    screen.score = score;
+    screen.scheme = scheme;
+    profilePhase(&main_profile, PHASE_DRAW, start);
 }
 
-uint8_t countEmpty(uint8_t board[SIZE][SIZE]) {
-    uint8_t x, y;
-    uint8_t count = 0;
-    for (x = 0; x < SIZE; x++) {
-        for (y = 0; y < SIZE; y++) {
-            if (board[x][y] == 0) {
-                count++;
+// boards of the other sizes are drawn whole every time, below their score
+void drawSizedBoard(const uint8_t *cells, uint8_t n, uint8_t scheme,
+                    uint32_t score) {
+    uint8_t x, y, line, value;
+    char text[96];
+    snprintf(text, sizeof(text), "\033[H2048.c %17d pts\n\n", score);
+    appendFrame(text);
+    for (y = 0; y < n; y++) {
+        for (line = 0; line < 3; line++) {
+            for (x = 0; x < n; x++) {
+                value = cells[n * x + y];
+                if (value >= TILE_VALUES) {
+                    value = TILE_VALUES - 1;
+                }
+                appendFrame(line == 1 ? tile_numbers[scheme][value]
+                                      : tile_blanks[scheme][value]);
             }
+            appendFrame("\n");
         }
     }
-    return count;
+    appendFrame("\n");
+    appendFrame("     ←,↑,→,↓,r or q        \n");
+    appendFrame("\033[A"); // one line up
+    writeFrame();
+    // the board of drawBoard is no longer on the screen
+    screen.drawn = false;
 }
 
-bool gameEnded(uint8_t board[SIZE][SIZE]) {
-    bool ended = true;
-    if (countEmpty(board) > 0)
-        return false;
-    if (findPairDown(board))
-        return false;
-    rotateBoard(board);
-    if (findPairDown(board))
-        ended = false;
-    rotateBoard(board);
-    rotateBoard(board);
-    rotateBoard(board);
-    return ended;
+// The history holds the last states of the game in a ring buffer that is
+// allocated once, the current state included, so that undo can go back up to
+// depth moves and redo can go forward again until a new move is made. The
+// masks of a state are not kept, they follow from its board.
+struct history_state {
+    board_t board;
+    rng_t rng;
+    uint32_t score;
+};
+
+struct history {
+    struct history_state *states;
+    uint32_t capacity;
+    uint32_t first; // where the oldest state is in the ring
+    uint32_t count;
+    uint32_t current; // counted from the oldest state
+};
+
+bool initHistory(struct history *history, uint32_t depth) {
+    history->capacity = depth + 1;
+    history->states = malloc(history->capacity * sizeof(struct history_state));
+    history->first = history->count = history->current = 0;
+    return history->states != NULL;
 }
 
-void addRandom(uint8_t board[SIZE][SIZE], time_t seed) {
-    srand(seed);
-    uint8_t x, y;
-    uint8_t r, len = 0;
-    uint8_t n, list[SIZE * SIZE][2];
+void freeHistory(struct history *history) {
+    free(history->states);
+}
 
-    for (x = 0; x < SIZE; x++) {
-        for (y = 0; y < SIZE; y++) {
-            if (board[x][y] == 0) {
-                list[len][0] = x;
-                list[len][1] = y;
-                len++;
-            }
-        }
+// makes the game the current state, the states after the former one are lost
+void pushState(struct history *history, const struct game *game) {
+    struct history_state *state;
+    if (history->count > 0) {
+        history->count = history->current + 1;
     }
-
-    if (len > 0) {
-        r = rand() % len;
-        x = list[r][0];
-        y = list[r][1];
-        n = (rand() % 10) / 9 + 1;
-        board[x][y] = n;
+    if (history->count == history->capacity) {
+        // forget the oldest state
+        history->first = (history->first + 1) % history->capacity;
+        history->count--;
     }
+    state = &history->states[(history->first + history->count) %
+                             history->capacity];
+    state->board = game->board;
+    state->rng = game->rng;
+    state->score = game->score;
+    history->current = history->count++;
 }
 
-void initBoard(uint8_t board[SIZE][SIZE]) {
-    uint8_t x, y;
-    for (x = 0; x < SIZE; x++) {
-        for (y = 0; y < SIZE; y++) {
-            board[x][y] = 0;
-        }
-    }
-    addRandom(board, rand());
-    addRandom(board, rand());
+void clearHistory(struct history *history, const struct game *game) {
+    history->count = 0;
+    pushState(history, game);
+}
+
+void restoreState(struct history *history, struct game *game) {
+    struct history_state *state =
+        &history->states[(history->first + history->current) %
+                         history->capacity];
+    game->board = state->board;
+    game->rng = state->rng;
+    game->score = state->score;
+    gameRefresh(game);
 }
 
-void backupState(uint8_t board[SIZE][SIZE], uint8_t bboard[SIZE][SIZE],
-                 uint32_t *score, uint32_t *bscore, time_t *seed,
-                 time_t *bseed) {
-    memcpy(bboard, board, SIZE * SIZE);
-    *bscore = *score;
-    *bseed = *seed;
+bool undoMove(struct history *history, struct game *game) {
+    if (history->current == 0) {
+        return false;
+    }
+    history->current--;
+    restoreState(history, game);
+    return true;
 }
 
-void updateSeed(time_t *seed) {
-    srand(*seed);
-    *seed = rand();
+bool redoMove(struct history *history, struct game *game) {
+    if (history->current + 1 >= history->count) {
+        return false;
+    }
+    history->current++;
+    restoreState(history, game);
+    return true;
 }
 
 void setBufferedInput(bool enable) {
@@ -307,6 +514,79 @@ void setBufferedInput(bool enable) {
     }
 }
 
+// the keys that are not a single character when they are read
+enum key {
+    KEY_NONE = -2, // nothing was pressed before the timeout
+    KEY_ERROR = -1,
+    KEY_UP = 256,
+    KEY_DOWN,
+    KEY_RIGHT,
+    KEY_LEFT
+};
+
+// the bytes of an escape sequence that follow the escape arrive right after
+// it, when they do not the escape key itself was pressed
+#define ESCAPE_TIMEOUT_MS 25
+
+// waits at most timeout_ms milliseconds (forever when -1) for a byte
+int readByte(int timeout_ms) {
+    struct pollfd input = {STDIN_FILENO, POLLIN, 0};
+    unsigned char byte;
+    int result = poll(&input, 1, timeout_ms);
+    if (result == 0) {
+        return KEY_NONE;
+    }
+    if (result < 0 || read(STDIN_FILENO, &byte, 1) != 1) {
+        return KEY_ERROR;
+    }
+    return byte;
+}
+
+// returns a character, an arrow key, KEY_NONE on timeout or KEY_ERROR
+int readKey(int timeout_ms) {
+    int c = readByte(timeout_ms), next;
+    if (c != 27) {
+        return c;
+    }
+    // the arrows send ESC [ A (or ESC O A) up to ESC [ D
+    next = readByte(ESCAPE_TIMEOUT_MS);
+    if (next != '[' && next != 'O') {
+        return next < 0 ? 27 : next;
+    }
+    // skip the parameters of longer sequences up to their final byte
+    do {
+        next = readByte(ESCAPE_TIMEOUT_MS);
+    } while (next >= '0' && next <= '?');
+    switch (next) {
+        case 'A':
+            return KEY_UP;
+        case 'B':
+            return KEY_DOWN;
+        case 'C':
+            return KEY_RIGHT;
+        case 'D':
+            return KEY_LEFT;
+        default:
+            return KEY_NONE;
+    }
+}
+
+// waits for a key like readKey(-1), but returns KEY_NONE as soon as wake_fd
+// can be read first, after draining it
+int readKeyOrWake(int wake_fd) {
+    struct pollfd fds[2] = {{STDIN_FILENO, POLLIN, 0}, {wake_fd, POLLIN, 0}};
+    char drain[64];
+    if (poll(fds, 2, -1) < 0) {
+        return KEY_ERROR;
+    }
+    if (fds[0].revents != 0) {
+        return readKey(-1);
+    }
+    while (read(wake_fd, drain, sizeof(drain)) > 0) {
+    }
+    return KEY_NONE;
+}
+
 char *concatenate(char *a, char *b) {
     char *c = calloc(1, strlen(a) + strlen(b) + 1);
     strcpy(c, a);
@@ -314,13 +594,21 @@ char *concatenate(char *a, char *b) {
     return c;
 }
 
+// the directory is looked up and created once, later calls return the same
+// string
 char *getGameDir() {
-    char *game_dir;
+    static char *game_dir = NULL;
+    char *config_dir;
+    if (game_dir != NULL) {
+        return game_dir;
+    }
     if (getenv("HOME") == NULL) {
         printf("Error!");
         exit(1);
     } else if (getenv("XDG_CONFIG_HOME") == NULL) {
-        game_dir = concatenate(concatenate(getenv("HOME"), "/.config"), "/2048");
+        config_dir = concatenate(getenv("HOME"), "/.config");
+        game_dir = concatenate(config_dir, "/2048");
+        free(config_dir);
     } else {
         game_dir = concatenate(getenv("XDG_CONFIG_HOME"), "/2048");
     }
@@ -328,263 +616,4321 @@ char *getGameDir() {
     return game_dir;
 }
 
-void writeScore(uint32_t score) {
-    char *score_file;
-    score_file = concatenate(getGameDir(), "/score.txt");
-    FILE *fptr;
-    fptr = fopen(score_file, "a");
-    if (fptr == NULL) {
-        printf("Error!");
-        exit(1);
+void putBytes(uint8_t *data, uint64_t value, uint8_t size) {
+    uint8_t i;
+    for (i = 0; i < size; i++) {
+        data[i] = value >> (8 * i);
     }
-    // print unixtime\tscore to file
-    fprintf(fptr, "%ld\t%u\n", time(NULL), score);
-    fclose(fptr);
 }
 
-bool loadStateFromFile(uint8_t board[SIZE][SIZE], uint32_t *score,
-                       time_t *seed) {
-    char *state_file;
-    state_file = concatenate(getGameDir(), "/state");
-    FILE *fptr;
-    fptr = fopen(state_file, "rb");
-    if (fptr == NULL) {
-        initBoard(board);
-        return false;
-    } else {
-        fread(board, sizeof(uint8_t), SIZE * SIZE, fptr);
-        fread(score, sizeof(uint32_t), 1, fptr);
-        fread(seed, sizeof(time_t), 1, fptr);
-        remove(state_file);
-        fclose(fptr);
-        return true;
+uint64_t getBytes(const uint8_t *data, uint8_t size) {
+    uint64_t value = 0;
+    uint8_t i;
+    for (i = 0; i < size; i++) {
+        value |= (uint64_t)data[i] << (8 * i);
     }
+    return value;
 }
 
-void writeStateToFile(uint8_t board[SIZE][SIZE], uint32_t *score,
-                      time_t *seed) {
-    char *state_file;
-    state_file = concatenate(getGameDir(), "/state");
-    FILE *fptr;
-    fptr = fopen(state_file, "wb");
-    if (fptr == NULL) {
-        printf("Error opening state file for writing!");
-    } else {
-        fwrite(board, sizeof(uint8_t), SIZE * SIZE, fptr);
-        fwrite(score, sizeof(uint32_t), 1, fptr);
-        fwrite(seed, sizeof(time_t), 1, fptr);
-        fclose(fptr);
+// The scores are a text log with a line per game, next to an index that
+// keeps the totals and the best scores, so that they need no scan of the log.
+// The log stays open while scores come in and is written in large chunks.
+// The index holds, all numbers little endian, the uint32 version, the 64-bit
+// length of the log it covers, games and total score, and the uint32 best
+// scores. When the log has another length, because a game crashed or another
+// one appended to it, the index is built anew.
+#define TOP_SCORES 10
+#define SCORE_INDEX_VERSION 2
+#define SCORE_INDEX_SIZE (28 + 4 * TOP_SCORES)
+
+struct score_index {
+    uint64_t log_size;
+    uint32_t best[TOP_SCORES]; // from high to low
+    uint64_t games;
+    uint64_t total_score;
+};
+
+struct score_store {
+    FILE *log;
+    char log_buffer[1 << 16];
+    struct score_index index;
+    pthread_mutex_t lock; // batch workers record their games at once
+};
+
+void addToIndex(struct score_index *index, uint32_t score) {
+    uint8_t i;
+    index->games++;
+    index->total_score += score;
+    for (i = TOP_SCORES; i > 0 && index->best[i - 1] < score; i--) {
+        if (i < TOP_SCORES) {
+            index->best[i] = index->best[i - 1];
+        }
+    }
+    if (i < TOP_SCORES) {
+        index->best[i] = score;
     }
 }
 
-int test() {
-    uint8_t array[SIZE];
-    // these are exponents with base 2 (1=2 2=4 3=8)
-    // data holds per line: 4x IN, 4x OUT, 1x POINTS
-    uint8_t data[] = {
-        0, 0, 0,  1, 1, 0, 0, 0, 0, 0, 0, 1, 1, 2, 0, 0, 0, 4,  0, 1, 0, 1, 2, 0,
-        0, 0, 4,  1, 0, 0, 1, 2, 0, 0, 0, 4, 1, 0, 1, 0, 2, 0,  0, 0, 4, 1, 1, 1,
-        0, 2, 1,  0, 0, 4, 1, 0, 1, 1, 2, 1, 0, 0, 4, 1, 1, 0,  1, 2, 1, 0, 0, 4,
-        1, 1, 1,  1, 2, 2, 0, 0, 8, 2, 2, 1, 1, 3, 2, 0, 0, 12, 1, 1, 2, 2, 2, 3,
-        0, 0, 12, 3, 0, 1, 1, 3, 2, 0, 0, 4, 2, 0, 1, 1, 2, 2,  0, 0, 4};
-    uint8_t *in, *out, *points;
-    uint8_t t, tests;
+void encodeScoreIndex(uint8_t data[SCORE_INDEX_SIZE],
+                      const struct score_index *index) {
     uint8_t i;
-    bool success = true;
-    uint32_t score;
+    putBytes(data, SCORE_INDEX_VERSION, 4);
+    putBytes(data + 4, index->log_size, 8);
+    putBytes(data + 12, index->games, 8);
+    putBytes(data + 20, index->total_score, 8);
+    for (i = 0; i < TOP_SCORES; i++) {
+        putBytes(data + 28 + 4 * i, index->best[i], 4);
+    }
+}
 
-    tests = (sizeof(data) / sizeof(data[0])) / (2 * SIZE + 1);
-    for (t = 0; t < tests; t++) {
-        in = data + t * (2 * SIZE + 1);
-        out = in + SIZE;
-        points = in + 2 * SIZE;
-        for (i = 0; i < SIZE; i++) {
-            array[i] = in[i];
-        }
-        score = 0;
-        slideArray(array, &score);
-        for (i = 0; i < SIZE; i++) {
-            if (array[i] != out[i]) {
-                success = false;
-            }
-        }
-        if (score != *points) {
-            success = false;
-        }
-        if (success == false) {
-            for (i = 0; i < SIZE; i++) {
-                printf("%d ", in[i]);
-            }
-            printf("=> ");
-            for (i = 0; i < SIZE; i++) {
-                printf("%d ", array[i]);
-            }
-            printf("(%d points) expected ", score);
-            for (i = 0; i < SIZE; i++) {
-                printf("%d ", in[i]);
-            }
-            printf("=> ");
-            for (i = 0; i < SIZE; i++) {
-                printf("%d ", out[i]);
+// false when the data is no index of a log of log_size bytes
+bool decodeScoreIndex(const uint8_t data[SCORE_INDEX_SIZE], uint64_t log_size,
+                      struct score_index *index) {
+    uint8_t i;
+    if (getBytes(data, 4) != SCORE_INDEX_VERSION ||
+        getBytes(data + 4, 8) != log_size) {
+        return false;
+    }
+    index->log_size = log_size;
+    index->games = getBytes(data + 12, 8);
+    index->total_score = getBytes(data + 20, 8);
+    for (i = 0; i < TOP_SCORES; i++) {
+        index->best[i] = getBytes(data + 28 + 4 * i, 4);
+    }
+    return true;
+}
+
+// reads the index, or builds it from the log when it does not cover the log
+void loadScoreIndex(struct score_index *index) {
+    char *index_file = concatenate(getGameDir(), "/scores.idx");
+    char *score_file = concatenate(getGameDir(), "/score.txt");
+    uint8_t data[SCORE_INDEX_SIZE];
+    struct stat info;
+    uint64_t log_size = stat(score_file, &info) == 0 ? info.st_size : 0;
+    bool valid = false;
+    FILE *fptr;
+    long seconds;
+    uint32_t score;
+    memset(index, 0, sizeof(*index));
+    fptr = fopen(index_file, "rb");
+    if (fptr != NULL) {
+        valid = fread(data, sizeof(data), 1, fptr) == 1 &&
+                decodeScoreIndex(data, log_size, index);
+        fclose(fptr);
+    }
+    if (!valid) {
+        memset(index, 0, sizeof(*index));
+        index->log_size = log_size;
+        fptr = fopen(score_file, "r");
+        if (fptr != NULL) {
+            while (fscanf(fptr, "%ld\t%u\n", &seconds, &score) == 2) {
+                addToIndex(index, score);
             }
-            printf("(%d points)\n", *points);
-            break;
+            fclose(fptr);
         }
     }
-    if (success) {
-        printf("All %u tests executed successfully\n", tests);
+    free(index_file);
+    free(score_file);
+}
+
+void openScoreStore(struct score_store *store) {
+    char *score_file = concatenate(getGameDir(), "/score.txt");
+    loadScoreIndex(&store->index);
+    store->log = fopen(score_file, "a");
+    if (store->log == NULL) {
+        printf("Error!");
+        exit(1);
     }
-    return !success;
+    setvbuf(store->log, store->log_buffer, _IOFBF, sizeof(store->log_buffer));
+    pthread_mutex_init(&store->lock, NULL);
+    free(score_file);
 }
 
-void signal_callback_handler(int signum) {
-    printf("         TERMINATED         \n");
-    setBufferedInput(true);
-    // make cursor visible, reset all modes
-    printf("\033[?25h\033[m");
-    exit(signum);
+void recordScore(struct score_store *store, uint32_t score) {
+    pthread_mutex_lock(&store->lock);
+    // print unixtime\tscore to file
+    store->index.log_size +=
+        fprintf(store->log, "%ld\t%u\n", time(NULL), score);
+    addToIndex(&store->index, score);
+    pthread_mutex_unlock(&store->lock);
 }
 
-int play(char *color_scheme, bool *do_load, bool *seed_hacking) {
-    bool state_loaded = false;
+// writes out the log and then the index that covers it
+void closeScoreStore(struct score_store *store) {
+    char *index_file = concatenate(getGameDir(), "/scores.idx");
+    uint8_t data[SCORE_INDEX_SIZE];
+    FILE *fptr;
+    fclose(store->log);
+    encodeScoreIndex(data, &store->index);
+    fptr = fopen(index_file, "wb");
+    if (fptr != NULL) {
+        fwrite(data, sizeof(data), 1, fptr);
+        fclose(fptr);
+    }
+    pthread_mutex_destroy(&store->lock);
+    free(index_file);
+}
 
-    uint8_t board[SIZE][SIZE];
-    uint8_t scheme = 0;
-    uint32_t score = 0;
-    time_t seed = time(NULL);
-    updateSeed(&seed);
+// The state file holds a game with its undo history in a fixed layout, all
+// numbers little endian, so that it loads on any platform:
+//   "2048", version byte, 3 zero bytes,
+//   board, 64-bit score, rng, uint32 history count, uint32 current state,
+//   the history states as board, rng and 64-bit score,
+//   and a 64-bit FNV-1a checksum of all the bytes before it.
+#define STATE_VERSION 1
+#define STATE_HEADER 40
+#define STATE_ENTRY 24
+#define LEGACY_STATE 28 // the cells, uint32 score and rng, native order
 
-    uint8_t backup_board[SIZE][SIZE];
-    uint32_t backup_score = 0;
-    time_t backup_seed = seed;
-    char c;
-    bool success;
-    if (strcmp(color_scheme, "blackwhite") == 0) {
-        scheme = 1;
-    }
-    if (strcmp(color_scheme, "bluered") == 0) {
-        scheme = 2;
+uint64_t checksum(const uint8_t *data, size_t size) {
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    size_t i;
+    for (i = 0; i < size; i++) {
+        hash = (hash ^ data[i]) * 0x100000001B3ULL;
     }
+    return hash;
+}
 
-    // make cursor invisible, erase entire screen
-    printf("\033[?25l\033[2J");
+size_t stateSize(uint32_t count) {
+    return STATE_HEADER + (size_t)count * STATE_ENTRY + 8;
+}
 
-    // register signal handler for when ctrl-c is pressed
-    signal(SIGINT, signal_callback_handler);
+// writes the state to data, which must hold stateSize(history->count) bytes
+size_t encodeState(uint8_t *data, const struct game *game,
+                   const struct history *history) {
+    struct history_state *state;
+    uint8_t *entry;
+    uint32_t i;
+    memcpy(data, "2048", 4);
+    putBytes(data + 4, STATE_VERSION, 4);
+    putBytes(data + 8, game->board, 8);
+    putBytes(data + 16, game->score, 8);
+    putBytes(data + 24, game->rng, 8);
+    putBytes(data + 32, history->count, 4);
+    putBytes(data + 36, history->current, 4);
+    for (i = 0; i < history->count; i++) {
+        state = &history->states[(history->first + i) % history->capacity];
+        entry = data + STATE_HEADER + i * STATE_ENTRY;
+        putBytes(entry, state->board, 8);
+        putBytes(entry + 8, state->rng, 8);
+        putBytes(entry + 16, state->score, 8);
+    }
+    entry = data + STATE_HEADER + history->count * STATE_ENTRY;
+    putBytes(entry, checksum(data, entry - data), 8);
+    return entry + 8 - data;
+}
 
-    if (*do_load) {
-        state_loaded = loadStateFromFile(board, &score, &seed);
-    } else {
-        initBoard(board);
+// reads a state, keeping the newest states of its history that fit
+bool decodeState(const uint8_t *data, size_t size, struct game *game,
+                 struct history *history) {
+    struct history_state *state;
+    const uint8_t *entry;
+    uint32_t count, current, skip, i;
+    if (size < stateSize(0) || memcmp(data, "2048", 4) != 0 ||
+        getBytes(data + 4, 4) != STATE_VERSION) {
+        return false;
     }
-    backupState(board, backup_board, &score, &backup_score, &seed, &backup_seed);
-    setBufferedInput(false);
-    drawBoard(board, scheme, score);
-    if (state_loaded) {
-        printf("       State loaded.      \n");
+    count = getBytes(data + 32, 4);
+    current = getBytes(data + 36, 4);
+    if (size != stateSize(count) || current >= count ||
+        getBytes(data + size - 8, 8) != checksum(data, size - 8)) {
+        return false;
     }
-    while (true) {
-        c = getchar();
-        if (c == -1) {
-            puts("\nError! Cannot read keyboard input!");
-            break;
-        }
-        switch (c) {
-            case 97:  // 'a' key
-            case 104: // 'h' key
-            case 68:  // left arrow
-                backupState(board, backup_board, &score, &backup_score, &seed,
-                            &backup_seed);
-                success = moveLeft(board, &score);
-                break;
-            case 100: // 'd' key
-            case 108: // 'l' key
-            case 67:  // right arrow
-                backupState(board, backup_board, &score, &backup_score, &seed,
-                            &backup_seed);
-                success = moveRight(board, &score);
+    game->board = getBytes(data + 8, 8);
+    game->score = getBytes(data + 16, 8);
+    game->rng = getBytes(data + 24, 8);
+    gameRefresh(game);
+    skip = count > history->capacity ? count - history->capacity : 0;
+    history->first = 0;
+    history->count = count - skip;
+    history->current = current > skip ? current - skip : 0;
+    for (i = 0; i < history->count; i++) {
+        entry = data + STATE_HEADER + (skip + i) * STATE_ENTRY;
+        state = &history->states[i];
+        state->board = getBytes(entry, 8);
+        state->rng = getBytes(entry + 8, 8);
+        state->score = getBytes(entry + 16, 8);
+    }
+    return true;
+}
+
+// loads the saved game in one read, the file is removed once it is loaded
+bool loadStateFromFile(struct game *game, struct history *history) {
+    uint8_t cells[SIZE][SIZE], *data, i;
+    char *state_file = concatenate(getGameDir(), "/state");
+    bool valid = false;
+    uint32_t score;
+    struct stat info;
+    FILE *fptr;
+    uint64_t start = profileClock();
+    fptr = fopen(state_file, "rb");
+    if (fptr != NULL && fstat(fileno(fptr), &info) == 0 && info.st_size > 0 &&
+        (data = malloc(info.st_size)) != NULL) {
+        if (fread(data, 1, info.st_size, fptr) == (size_t)info.st_size) {
+            valid = decodeState(data, info.st_size, game, history);
+            if (!valid && info.st_size == LEGACY_STATE) {
+                // a 65536 of the former array game does not fit, keep a
+                // 32768
+                for (i = 0; i < SIZE * SIZE; i++) {
+                    data[i] = data[i] < 15 ? data[i] : 15;
+                }
+                memcpy(cells, data, SIZE * SIZE);
+                memcpy(&score, data + SIZE * SIZE, sizeof(score));
+                memcpy(&game->rng, data + SIZE * SIZE + sizeof(score),
+                       sizeof(game->rng));
+                game->board = packBoard(cells);
+                game->score = score;
+                gameRefresh(game);
+                clearHistory(history, game);
+                valid = true;
+            }
+        }
+        free(data);
+    }
+    if (fptr != NULL) {
+        fclose(fptr);
+    }
+    if (valid) {
+        remove(state_file);
+    }
+    free(state_file);
+    profilePhase(&main_profile, PHASE_STATE, start);
+    return valid;
+}
+
+// writes a temporary file first and renames it over the state file, so a
+// crash leaves either the former state or the new one
+bool writeStateToFile(struct game *game, struct history *history) {
+    char *state_file = concatenate(getGameDir(), "/state");
+    char *temporary_file = concatenate(state_file, ".tmp");
+    uint8_t *data = malloc(stateSize(history->count));
+    size_t size;
+    bool success = false;
+    FILE *fptr;
+    uint64_t start = profileClock();
+    if (data != NULL && (fptr = fopen(temporary_file, "wb")) != NULL) {
+        size = encodeState(data, game, history);
+        success = fwrite(data, 1, size, fptr) == size && fflush(fptr) == 0 &&
+                  fsync(fileno(fptr)) == 0;
+        success = fclose(fptr) == 0 && success &&
+                  rename(temporary_file, state_file) == 0;
+        if (!success) {
+            remove(temporary_file);
+        }
+    }
+    if (!success) {
+        printf("Error opening state file for writing!");
+    }
+    free(data);
+    free(temporary_file);
+    free(state_file);
+    profilePhase(&main_profile, PHASE_STATE, start);
+    return success;
+}
+
+// removes a checkpoint once the game it saved is over
+void removeStateFile() {
+    char *state_file = concatenate(getGameDir(), "/state");
+    remove(state_file);
+    free(state_file);
+}
+
+// The journal is a file of records that is only ever appended to. A record
+// starts with a byte: below 0x80 it is the number of moves whose directions
+// follow in 2 bits each, four to a byte with the first move in the low bits,
+// otherwise it is one of the events below. As the spawns follow from the rng
+// state, the moves are all it takes to play a game back.
+enum journal_event {
+    JOURNAL_SESSION = 0x80, // version byte, uint32 history depth
+    JOURNAL_STATE,          // board, uint32 score, rng: a new or loaded game
+    JOURNAL_RESTART,        // a new game from the current rng state
+    JOURNAL_UNDO,
+    JOURNAL_REDO,
+    JOURNAL_RESEED,         // rng: the seed was changed after an undo
+    JOURNAL_CHECK           // board, uint32 score: where the game should be
+};
+
+#define JOURNAL_VERSION 1
+#define JOURNAL_BLOCK 124 // the most moves in a record, a multiple of 4
+
+struct journal {
+    int fd; // -1 when no journal is written
+    uint8_t buffer[4096];
+    uint32_t length;
+    uint8_t moves[JOURNAL_BLOCK / 4];
+    uint8_t move_count;
+    uint32_t sync_moves; // moves between syncs, 0 to sync when closing
+    uint32_t unsynced;
+};
+
+void flushJournal(struct journal *journal) {
+    uint32_t written = 0;
+    ssize_t result;
+    uint64_t start = profileClock();
+    while (written < journal->length) {
+        result = write(journal->fd, journal->buffer + written,
+                       journal->length - written);
+        if (result <= 0) {
+            break;
+        }
+        written += result;
+    }
+    journal->length = 0;
+    profilePhase(&main_profile, PHASE_STATE, start);
+}
+
+void appendJournal(struct journal *journal, const void *data,
+                   uint32_t length) {
+    if (journal->length + length > sizeof(journal->buffer)) {
+        flushJournal(journal);
+    }
+    memcpy(journal->buffer + journal->length, data, length);
+    journal->length += length;
+}
+
+void appendMoves(struct journal *journal) {
+    if (journal->move_count > 0) {
+        appendJournal(journal, &journal->move_count, 1);
+        appendJournal(journal, journal->moves, (journal->move_count + 3) / 4);
+        memset(journal->moves, 0, sizeof(journal->moves));
+        journal->move_count = 0;
+    }
+}
+
+// writes out the buffer and waits until it is on the disk
+void syncJournal(struct journal *journal) {
+    uint64_t start;
+    if (journal->fd < 0) {
+        return;
+    }
+    appendMoves(journal);
+    flushJournal(journal);
+    start = profileClock();
+    fsync(journal->fd);
+    profilePhase(&main_profile, PHASE_STATE, start);
+    journal->unsynced = 0;
+}
+
+// a closed journal takes the events without writing them
+void initJournal(struct journal *journal) {
+    journal->fd = -1;
+    journal->length = 0;
+    journal->move_count = 0;
+    memset(journal->moves, 0, sizeof(journal->moves));
+}
+
+bool openJournal(struct journal *journal, char *path, uint32_t depth,
+                 uint32_t sync_moves) {
+    uint8_t session[2] = {JOURNAL_SESSION, JOURNAL_VERSION};
+    initJournal(journal);
+    journal->fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0666);
+    journal->sync_moves = sync_moves;
+    journal->unsynced = 0;
+    if (journal->fd < 0) {
+        return false;
+    }
+    appendJournal(journal, session, sizeof(session));
+    appendJournal(journal, &depth, sizeof(depth));
+    return true;
+}
+
+void closeJournal(struct journal *journal) {
+    if (journal->fd >= 0) {
+        syncJournal(journal);
+        close(journal->fd);
+        journal->fd = -1;
+    }
+}
+
+void journalMove(struct journal *journal, uint8_t direction) {
+    if (journal->fd < 0) {
+        return;
+    }
+    journal->moves[journal->move_count / 4] |= direction
+                                               << (2 * (journal->move_count % 4));
+    if (++journal->move_count == JOURNAL_BLOCK) {
+        appendMoves(journal);
+    }
+    if (journal->sync_moves > 0 && ++journal->unsynced >= journal->sync_moves) {
+        syncJournal(journal);
+    }
+}
+
+// records an event, together with the parts of the game it needs
+void journalEvent(struct journal *journal, uint8_t event,
+                  const struct game *game) {
+    uint8_t tag = event;
+    if (journal->fd < 0) {
+        return;
+    }
+    appendMoves(journal);
+    appendJournal(journal, &tag, 1);
+    if (event == JOURNAL_STATE || event == JOURNAL_CHECK) {
+        appendJournal(journal, &game->board, sizeof(game->board));
+        appendJournal(journal, &game->score, sizeof(game->score));
+    }
+    if (event == JOURNAL_STATE || event == JOURNAL_RESEED) {
+        appendJournal(journal, &game->rng, sizeof(game->rng));
+    }
+}
+
+double getSeconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+uint64_t getNanoseconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+// the built-in players and their settings
+struct player_settings {
+    char *name;
+    uint8_t depth;      // expectimax: deepest search, in moves
+    uint32_t budget_ms; // expectimax: time to think per move, 0 for no limit
+    uint32_t rollouts;  // montecarlo: random games played per move
+    uint32_t threads;   // montecarlo: threads playing them, 0 for all cores
+    struct tt_bucket *shared_tt; // expectimax: a table to share, or NULL
+};
+
+// The search remembers the positions it already expanded in a table of cache
+// line sized buckets, that is allocated once and kept warm between moves. A
+// position is stored as the canonical one of its 8 symmetries, which all have
+// the same value. The first ways of a bucket keep the deepest results and the
+// last one takes whatever comes, so that fresh results always find a place.
+#define TT_WAYS 4
+#define TT_BUCKETS (1 << 16)
+
+// Solvers on other threads may share a table without locks: an entry is two
+// words written one after the other, and holds the board xor its data, so
+// that a torn entry never matches a board.
+struct tt_entry {
+    uint64_t check; // the board xor the data
+    uint64_t data;  // the value in the low half, the depth in the high half
+};
+
+struct tt_bucket {
+    struct tt_entry entries[TT_WAYS];
+};
+
+struct solver {
+    struct tt_bucket *tt;
+    bool shared_tt; // owned by someone else
+    uint8_t depth;
+    uint32_t budget_ms;
+    double deadline;
+    uint32_t nodes;
+    bool timeout;
+    // a search on another thread stops once *cancel is no longer root
+    const uint32_t *cancel;
+    uint32_t root;
+};
+
+// a player picks the next move for a board that still has one
+struct player {
+    uint8_t (*move)(struct player *player, board_t board);
+    // for the boards of the other sizes, NULL when the player only plays 4x4
+    uint8_t (*sized_move)(struct player *player, const struct sized_game *game);
+    rng_t rng;
+    struct solver solver;
+    struct rollout_pool *pool;
+    uint64_t rollouts;      // rollouts played so far
+    double rollout_seconds; // time spent playing them
+};
+
+// nneonneo's heuristic, scored per line: reward empty cells, neighbours that
+// can merge and lines that only go up or down, punish many big tiles
+float line_heuristic[1 << 16];
+
+void initHeuristic() {
+    uint32_t line;
+    uint8_t j, cells[SIZE], empty, merges, previous, counter;
+    double sum, left, right;
+    for (line = 0; line < (1 << 16); line++) {
+        empty = merges = previous = counter = 0;
+        sum = left = right = 0;
+        for (j = 0; j < SIZE; j++) {
+            cells[j] = (line >> 4 * j) & 0xf;
+            sum += pow(cells[j], 3.5);
+            if (cells[j] == 0) {
+                empty++;
+            } else if (cells[j] == previous) {
+                counter++;
+            } else {
+                if (counter > 0) {
+                    merges += 1 + counter;
+                }
+                counter = 0;
+                previous = cells[j];
+            }
+        }
+        if (counter > 0) {
+            merges += 1 + counter;
+        }
+        for (j = 1; j < SIZE; j++) {
+            if (cells[j - 1] > cells[j]) {
+                left += pow(cells[j - 1], 4) - pow(cells[j], 4);
+            } else {
+                right += pow(cells[j], 4) - pow(cells[j - 1], 4);
+            }
+        }
+        line_heuristic[line] = 200000.0 + 270.0 * empty + 700.0 * merges -
+                               47.0 * (left < right ? left : right) -
+                               11.0 * sum;
+    }
+}
+
+float evaluateBoard(board_t board) {
+    board_t rows = transpose(board);
+    float value = 0;
+    uint8_t i;
+    for (i = 0; i < SIZE; i++) {
+        value += line_heuristic[(board >> 16 * i) & 0xffff] +
+                 line_heuristic[(rows >> 16 * i) & 0xffff];
+    }
+    return value;
+}
+
+struct tt_bucket *newTable() {
+    void *tt;
+    if (posix_memalign(&tt, 64, TT_BUCKETS * sizeof(struct tt_bucket)) != 0) {
+        return NULL;
+    }
+    memset(tt, 0, TT_BUCKETS * sizeof(struct tt_bucket));
+    return tt;
+}
+
+// plays with its own table, or on the one given when it is shared
+bool initSolver(struct solver *solver, uint8_t depth, uint32_t budget_ms,
+                struct tt_bucket *shared_tt) {
+    solver->tt = shared_tt != NULL ? shared_tt : newTable();
+    if (solver->tt == NULL) {
+        return false;
+    }
+    solver->shared_tt = shared_tt != NULL;
+    solver->cancel = NULL;
+    solver->depth = depth;
+    solver->budget_ms = budget_ms;
+    return true;
+}
+
+void freeSolver(struct solver *solver) {
+    if (!solver->shared_tt) {
+        free(solver->tt);
+    }
+}
+
+struct tt_bucket *findBucket(struct tt_bucket *tt, board_t board) {
+    return &tt[(board * 0x9E3779B97F4A7C15ULL) >> 48];
+}
+
+// the entries are read and written with relaxed atomics, which are plain
+// loads and stores on every cpu, for the tables that are shared
+void readEntry(struct tt_entry *entry, board_t *board, uint32_t *depth,
+               float *value) {
+    uint64_t check = __atomic_load_n(&entry->check, __ATOMIC_RELAXED);
+    uint64_t data = __atomic_load_n(&entry->data, __ATOMIC_RELAXED);
+    uint32_t bits = data;
+    *board = check ^ data;
+    *depth = data >> 32;
+    memcpy(value, &bits, sizeof(float));
+}
+
+void writeEntry(struct tt_entry *entry, board_t board, uint32_t depth,
+                float value) {
+    uint32_t bits;
+    uint64_t data;
+    memcpy(&bits, &value, sizeof(float));
+    data = (uint64_t)depth << 32 | bits;
+    __atomic_store_n(&entry->check, board ^ data, __ATOMIC_RELAXED);
+    __atomic_store_n(&entry->data, data, __ATOMIC_RELAXED);
+}
+
+// finds the value of a canonical board searched at least depth moves deep
+bool probeTable(struct tt_bucket *tt, board_t board, uint32_t depth,
+                float *value) {
+    struct tt_bucket *bucket = findBucket(tt, board);
+    board_t stored;
+    uint32_t stored_depth;
+    uint8_t i;
+    for (i = 0; i < TT_WAYS; i++) {
+        readEntry(&bucket->entries[i], &stored, &stored_depth, value);
+        if (stored == board && stored_depth >= depth && stored_depth > 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void storeTable(struct tt_bucket *tt, board_t board, uint32_t depth,
+                float value) {
+    struct tt_bucket *bucket = findBucket(tt, board);
+    struct tt_entry *victim = &bucket->entries[0];
+    board_t stored, victim_board = 0;
+    uint32_t stored_depth, victim_depth = UINT32_MAX;
+    float stored_value, victim_value = 0;
+    uint8_t i;
+    for (i = 0; i < TT_WAYS; i++) {
+        readEntry(&bucket->entries[i], &stored, &stored_depth, &stored_value);
+        // a board is only kept once, with its deepest result
+        if (stored == board && stored_depth > 0) {
+            if (depth >= stored_depth) {
+                writeEntry(&bucket->entries[i], board, depth, value);
+            }
+            return;
+        }
+        if (i < TT_WAYS - 1 && stored_depth < victim_depth) {
+            victim = &bucket->entries[i];
+            victim_board = stored;
+            victim_depth = stored_depth;
+            victim_value = stored_value;
+        }
+    }
+    if (depth < victim_depth) {
+        writeEntry(&bucket->entries[TT_WAYS - 1], board, depth, value);
+        return;
+    }
+    // the shallowest of the deep results moves over to the last way
+    if (victim_depth > 0) {
+        writeEntry(&bucket->entries[TT_WAYS - 1], victim_board, victim_depth,
+                   victim_value);
+    }
+    writeEntry(victim, board, depth, value);
+}
+
+float expectMax(struct solver *solver, board_t board, uint8_t depth,
+                float probability);
+
+// the value of a board that just got a move, averaged over every tile that
+// can spawn next: a 2 nine out of ten times, a 4 otherwise
+float expectChance(struct solver *solver, board_t board, uint8_t depth,
+                   float probability) {
+    uint64_t empty = emptyCells(board), cell;
+    board_t canonical;
+    uint8_t count = popCount(empty);
+    float value = 0;
+
+    // stop at the horizon, and ignore spawn sequences that hardly ever happen
+    if (depth == 0 || probability < 0.0001f || count == 0) {
+        return evaluateBoard(board);
+    }
+    if (solver->timeout) {
+        return 0;
+    }
+    if (++solver->nodes % 4096 == 0 && solver->budget_ms > 0 &&
+        getSeconds() > solver->deadline) {
+        solver->timeout = true;
+        return 0;
+    }
+    if (solver->cancel != NULL && solver->nodes % 256 == 0 &&
+        __atomic_load_n(solver->cancel, __ATOMIC_RELAXED) != solver->root) {
+        solver->timeout = true;
+        return 0;
+    }
+    canonical = canonicalBoard(board);
+    if (probeTable(solver->tt, canonical, depth, &value)) {
+        return value;
+    }
+    value = 0;
+    probability /= count;
+    for (; empty; empty &= empty - 1) {
+        cell = empty & -empty;
+        value += 0.9f * expectMax(solver, board | cell, depth,
+                                  probability * 0.9f) +
+                 0.1f * expectMax(solver, board | cell * 2, depth,
+                                  probability * 0.1f);
+    }
+    value /= count;
+    if (!solver->timeout) {
+        storeTable(solver->tt, canonical, depth, value);
+    }
+    return value;
+}
+
+// the value of the best move, or 0 when the game is lost
+float expectMax(struct solver *solver, board_t board, uint8_t depth,
+                float probability) {
+    float value, best = 0;
+    board_t next;
+    uint32_t score = 0;
+    uint8_t d;
+    for (d = UP; d <= RIGHT; d++) {
+        next = board;
+        if (bitboardMove(&next, d, &score)) {
+            value = expectChance(solver, next, depth - 1, probability);
+            if (value > best) {
+                best = value;
+            }
+        }
+    }
+    return best;
+}
+
+// the best move of a search that looks depth moves ahead, with its value
+uint8_t searchDepth(struct solver *solver, board_t board, uint8_t depth,
+                    float *best_value) {
+    uint8_t d, best = UP;
+    float move_value;
+    board_t next;
+    uint32_t score = 0;
+    *best_value = -1;
+    for (d = UP; d <= RIGHT; d++) {
+        next = board;
+        if (bitboardMove(&next, d, &score)) {
+            move_value = expectChance(solver, next, depth - 1, 1.0f);
+            if (move_value > *best_value) {
+                *best_value = move_value;
+                best = d;
+            }
+        }
+    }
+    return best;
+}
+
+// searches one move deeper each time until the depth or the time budget is
+// used up, and plays the best move of the deepest search that completed
+uint8_t solveMove(struct solver *solver, board_t board, float *value) {
+    uint8_t depth, best, deepest_best = UP;
+    float best_value, deepest_value = -1;
+    solver->deadline = getSeconds() + solver->budget_ms / 1000.0;
+    solver->timeout = false;
+    for (depth = 1; depth <= solver->depth && !solver->timeout; depth++) {
+        best = searchDepth(solver, board, depth, &best_value);
+        // the shallowest search always counts, so there is a move to play
+        if (!solver->timeout || depth == 1) {
+            deepest_best = best;
+            deepest_value = best_value;
+        }
+    }
+    if (value != NULL) {
+        *value = deepest_value;
+    }
+    return deepest_best;
+}
+
+// The Monte Carlo player plays random games to the end after every legal move
+// and takes the move with the best mean score. The rollouts are handed out in
+// small tasks to a pool of threads that each own a deque of them: a thread
+// pops from the bottom of its own deque and, once that is empty, steals from
+// the top of the others, so that no thread idles while there is work left.
+#define ROLLOUT_CHUNK 16
+
+struct rollout_task {
+    board_t board; // the board right after the move
+    uint32_t score; // the points the move itself made
+    uint8_t direction;
+    uint32_t rollouts;
+};
+
+struct rollout_deque {
+    pthread_mutex_t lock;
+    struct rollout_task *tasks;
+    uint32_t top;    // thieves take from here
+    uint32_t bottom; // the owner takes from here
+};
+
+struct rollout_worker {
+    pthread_t thread;
+    struct rollout_pool *pool;
+    uint32_t index;
+    struct rollout_deque deque;
+    rng_t rng;
+    double totals[4];
+    uint32_t counts[4];
+};
+
+struct rollout_pool {
+    uint32_t threads;
+    uint32_t rollouts;
+    struct rollout_worker *workers;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t done;
+    uint32_t round; // counts up for every move to search
+    uint32_t busy;  // workers still busy with the current round
+    bool quit;
+};
+
+// plays uniformly random moves until the game is over, returns the points
+uint32_t randomRollout(board_t board, rng_t *rng) {
+    board_t next[4];
+    uint32_t score = 0, scores[4];
+    uint8_t d, count;
+    bitboardAddRandom(&board, rng);
+    while (!bitboardGameEnded(board)) {
+        count = 0;
+        for (d = UP; d <= RIGHT; d++) {
+            next[count] = board;
+            scores[count] = 0;
+            if (bitboardMove(&next[count], d, &scores[count])) {
+                count++;
+            }
+        }
+        d = rngBelow(rng, count);
+        board = next[d];
+        score += scores[d];
+        bitboardAddRandom(&board, rng);
+    }
+    return score;
+}
+
+bool takeRolloutTask(struct rollout_worker *worker, struct rollout_task *task) {
+    struct rollout_pool *pool = worker->pool;
+    struct rollout_deque *deque = &worker->deque;
+    bool found = false;
+    uint32_t i;
+
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom > deque->top) {
+        *task = deque->tasks[--deque->bottom];
+        found = true;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    for (i = 1; i < pool->threads && !found; i++) {
+        deque = &pool->workers[(worker->index + i) % pool->threads].deque;
+        pthread_mutex_lock(&deque->lock);
+        if (deque->bottom > deque->top) {
+            *task = deque->tasks[deque->top++];
+            found = true;
+        }
+        pthread_mutex_unlock(&deque->lock);
+    }
+    return found;
+}
+
+void *runRolloutWorker(void *arg) {
+    struct rollout_worker *worker = arg;
+    struct rollout_pool *pool = worker->pool;
+    struct rollout_task task;
+    uint32_t i, round = 0;
+
+    while (true) {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->round == round && !pool->quit) {
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        }
+        if (pool->quit) {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        round = pool->round;
+        pthread_mutex_unlock(&pool->lock);
+
+        // tasks are only added between rounds, so no task left means done
+        while (takeRolloutTask(worker, &task)) {
+            for (i = 0; i < task.rollouts; i++) {
+                worker->totals[task.direction] +=
+                    task.score + randomRollout(task.board, &worker->rng);
+            }
+            worker->counts[task.direction] += task.rollouts;
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->busy == 0) {
+            pthread_cond_signal(&pool->done);
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+void freeRolloutPool(struct rollout_pool *pool) {
+    uint32_t i;
+    if (pool == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = true;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+    for (i = 0; i < pool->threads; i++) {
+        pthread_join(pool->workers[i].thread, NULL);
+        pthread_mutex_destroy(&pool->workers[i].deque.lock);
+        free(pool->workers[i].deque.tasks);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->wake);
+    pthread_cond_destroy(&pool->done);
+    free(pool->workers);
+    free(pool);
+}
+
+struct rollout_pool *newRolloutPool(uint32_t threads, uint32_t rollouts,
+                                    rng_t *seeds) {
+    struct rollout_pool *pool = calloc(1, sizeof(struct rollout_pool));
+    // a deque has to hold all tasks of a move, that go to one thread at most
+    uint32_t i, capacity = 4 * ((rollouts + ROLLOUT_CHUNK - 1) / ROLLOUT_CHUNK);
+    if (pool == NULL) {
+        return NULL;
+    }
+    pool->rollouts = rollouts;
+    pool->workers = calloc(threads, sizeof(struct rollout_worker));
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    for (i = 0; pool->workers != NULL && i < threads; i++) {
+        struct rollout_worker *worker = &pool->workers[i];
+        worker->pool = pool;
+        worker->index = i;
+        worker->rng = rngNext(seeds);
+        worker->deque.tasks = malloc(capacity * sizeof(struct rollout_task));
+        if (worker->deque.tasks == NULL) {
+            break;
+        }
+        pthread_mutex_init(&worker->deque.lock, NULL);
+        if (pthread_create(&worker->thread, NULL, runRolloutWorker, worker)) {
+            pthread_mutex_destroy(&worker->deque.lock);
+            free(worker->deque.tasks);
+            break;
+        }
+        pool->threads++;
+    }
+    if (pool->threads < threads) {
+        freeRolloutPool(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+uint8_t playMonteCarlo(struct player *player, board_t board) {
+    struct rollout_pool *pool = player->pool;
+    struct rollout_task task;
+    struct rollout_worker *worker;
+    double totals[4] = {0}, start = getSeconds();
+    uint32_t i, counts[4] = {0}, next_worker = 0;
+    uint8_t d, best = UP;
+    double mean, best_mean = -1;
+
+    // the workers are all waiting, so their deques can be filled without locks
+    for (i = 0; i < pool->threads; i++) {
+        worker = &pool->workers[i];
+        worker->deque.top = worker->deque.bottom = 0;
+        memset(worker->totals, 0, sizeof(worker->totals));
+        memset(worker->counts, 0, sizeof(worker->counts));
+    }
+    for (d = UP; d <= RIGHT; d++) {
+        task.board = board;
+        task.score = 0;
+        task.direction = d;
+        if (!bitboardMove(&task.board, d, &task.score)) {
+            continue;
+        }
+        for (i = 0; i < pool->rollouts; i += ROLLOUT_CHUNK) {
+            task.rollouts = pool->rollouts - i < ROLLOUT_CHUNK
+                                ? pool->rollouts - i
+                                : ROLLOUT_CHUNK;
+            worker = &pool->workers[next_worker++ % pool->threads];
+            worker->deque.tasks[worker->deque.bottom++] = task;
+        }
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->busy = pool->threads;
+    pool->round++;
+    pthread_cond_broadcast(&pool->wake);
+    while (pool->busy > 0) {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    for (i = 0; i < pool->threads; i++) {
+        for (d = UP; d <= RIGHT; d++) {
+            totals[d] += pool->workers[i].totals[d];
+            counts[d] += pool->workers[i].counts[d];
+        }
+    }
+    for (d = UP; d <= RIGHT; d++) {
+        if (counts[d] > 0) {
+            mean = totals[d] / counts[d];
+            if (mean > best_mean) {
+                best_mean = mean;
+                best = d;
+            }
+            player->rollouts += counts[d];
+        }
+    }
+    player->rollout_seconds += getSeconds() - start;
+    return best;
+}
+
+uint8_t playRandom(struct player *player, board_t board) {
+    uint8_t d, count = 0, legal[4];
+    board_t next;
+    uint32_t score = 0;
+    for (d = UP; d <= RIGHT; d++) {
+        next = board;
+        if (engineMove(&next, d, &score)) {
+            legal[count++] = d;
+        }
+    }
+    return legal[rngBelow(&player->rng, count)];
+}
+
+// takes the move that scores most, or when that is a tie the one that
+// leaves the most empty cells
+uint8_t playGreedy(struct player *player, board_t board) {
+    uint8_t d, best = UP;
+    int32_t value, best_value = -1;
+    board_t next;
+    uint32_t score;
+    (void)player;
+    for (d = UP; d <= RIGHT; d++) {
+        next = board;
+        score = 0;
+        if (engineMove(&next, d, &score)) {
+            value = score * (SIZE * SIZE + 1) + bitboardCountEmpty(next);
+            if (value > best_value) {
+                best_value = value;
+                best = d;
+            }
+        }
+    }
+    return best;
+}
+
+uint8_t playSizedRandom(struct player *player, const struct sized_game *game) {
+    uint8_t d, count = 0, legal[4], cells[MAX_SIZE * MAX_SIZE];
+    uint32_t score = 0;
+    for (d = UP; d <= RIGHT; d++) {
+        memcpy(cells, game->cells, sizeof(cells));
+        if (game->kernels->move(cells, d, &score)) {
+            legal[count++] = d;
+        }
+    }
+    return legal[rngBelow(&player->rng, count)];
+}
+
+uint8_t playSizedGreedy(struct player *player, const struct sized_game *game) {
+    uint8_t d, best = UP, n = game->kernels->size;
+    uint8_t cells[MAX_SIZE * MAX_SIZE];
+    int64_t value, best_value = -1;
+    uint32_t score;
+    (void)player;
+    for (d = UP; d <= RIGHT; d++) {
+        memcpy(cells, game->cells, sizeof(cells));
+        score = 0;
+        if (game->kernels->move(cells, d, &score)) {
+            value = (int64_t)score * (n * n + 1) +
+                    game->kernels->count_empty(cells);
+            if (value > best_value) {
+                best_value = value;
+                best = d;
+            }
+        }
+    }
+    return best;
+}
+
+uint8_t playExpectimax(struct player *player, board_t board) {
+    return solveMove(&player->solver, board, NULL);
+}
+
+bool initPlayer(struct player *player, struct player_settings *settings,
+                rng_t seed) {
+    memset(player, 0, sizeof(struct player));
+    player->rng = seed;
+    if (strcmp(settings->name, "random") == 0) {
+        player->move = playRandom;
+        player->sized_move = playSizedRandom;
+    } else if (strcmp(settings->name, "greedy") == 0) {
+        player->move = playGreedy;
+        player->sized_move = playSizedGreedy;
+    } else if (strcmp(settings->name, "expectimax") == 0) {
+        player->move = playExpectimax;
+        if (!initSolver(&player->solver, settings->depth,
+                        settings->budget_ms, settings->shared_tt)) {
+            printf("Error allocating the transposition table!\n");
+            return false;
+        }
+    } else if (strcmp(settings->name, "montecarlo") == 0) {
+        player->move = playMonteCarlo;
+        player->pool = newRolloutPool(
+            settings->threads > 0 ? settings->threads
+                                  : (uint32_t)sysconf(_SC_NPROCESSORS_ONLN),
+            settings->rollouts > 0 ? settings->rollouts : 1, &player->rng);
+        if (player->pool == NULL) {
+            printf("Error starting the rollout threads!\n");
+            return false;
+        }
+    } else {
+        printf("Unknown player: %s\n", settings->name);
+        return false;
+    }
+    return true;
+}
+
+void freePlayer(struct player *player) {
+    freeSolver(&player->solver);
+    freeRolloutPool(player->pool);
+}
+
+// the choices of the command line that play and batch mode run with
+struct options {
+    bool test_mode;
+    bool do_load;
+    bool seed_hacking;
+    char color_scheme[10];
+    uint32_t batch_games;
+    struct player_settings player;
+    uint32_t threads;
+    bool autoplay;
+    bool diff;
+    uint32_t animation_ms; // between sliding the tiles and the spawn
+    bool drop_keys; // instead of applying the keys pressed during it
+    uint32_t history_depth;
+    bool journal;
+    uint32_t sync_moves;
+    uint32_t checkpoint_moves; // moves between saves of the state, 0 for none
+    bool record_batch; // add the batch games to the high scores
+    bool stats;
+    char *replay_file;
+    char *bench_format; // csv or json
+    char *batch_format; // text, csv or json
+    uint32_t progress_s; // between the progress reports of a batch, 0 for none
+    uint32_t replay_speed; // moves per second, 0 to verify headless
+    uint8_t size; // of the board, from MIN_SIZE to MAX_SIZE
+    bool pipe;
+    char *listen; // the tcp port or unix socket to serve agents on
+    char *bind; // the address of the interface the tcp port is on
+    bool profile;
+    bool hints; // search the board while the player thinks
+    uint32_t explore_seeds; // to rank, 0 when not exploring
+    board_t board; // the position to explore, 0 for a new game
+    uint32_t horizon; // moves per explored seed, 0 for no limit
+    uint32_t target; // the score that ends the exploring, 0 for none
+    char *archive; // written by batch mode, checked otherwise
+    uint32_t archive_checkpoints; // moves between the boards archived
+};
+
+// With --archive the batch games are written to an archive, in the format of
+// lib2048.h. Every worker records its game in buffers of its own and hands it
+// to the writer when it is over, which appends it to the file in one go and
+// keeps its offset for the index that closes the archive.
+struct archive_writer {
+    FILE *file;
+    uint64_t offset; // where the next game goes
+    uint64_t *index;
+    uint64_t games, capacity;
+    uint32_t checkpoint_moves;
+    bool failed;
+    pthread_mutex_t lock;
+};
+
+struct recording {
+    uint64_t seed;
+    uint32_t moves;
+    uint8_t *directions; // 2 bits per move, padded to 8 bytes
+    uint8_t *checkpoints;
+    size_t capacity; // in moves, of both buffers
+    bool failed;
+};
+
+// starts an archive in a file that was just opened for writing
+void openArchiveWriter(struct archive_writer *writer, FILE *file,
+                       uint32_t checkpoint_moves) {
+    uint8_t header[ARCHIVE_HEADER];
+    memset(writer, 0, sizeof(struct archive_writer));
+    writer->file = file;
+    writer->checkpoint_moves = checkpoint_moves;
+    memcpy(header, ARCHIVE_MAGIC, 8);
+    putBytes(header + 8, ARCHIVE_VERSION, 4);
+    putBytes(header + 12, checkpoint_moves, 4);
+    writer->failed = fwrite(header, ARCHIVE_HEADER, 1, writer->file) != 1;
+    writer->offset = ARCHIVE_HEADER;
+    pthread_mutex_init(&writer->lock, NULL);
+}
+
+// writes the index and the footer, false when any write failed, the file is
+// left to close
+bool closeArchiveWriter(struct archive_writer *writer) {
+    uint8_t entry[8], footer[ARCHIVE_FOOTER];
+    uint64_t i;
+    for (i = 0; i < writer->games && !writer->failed; i++) {
+        putBytes(entry, writer->index[i], 8);
+        writer->failed = fwrite(entry, 8, 1, writer->file) != 1;
+    }
+    putBytes(footer, writer->offset, 8);
+    putBytes(footer + 8, writer->games, 8);
+    memcpy(footer + 16, ARCHIVE_MAGIC, 8);
+    if (!writer->failed) {
+        writer->failed = fwrite(footer, ARCHIVE_FOOTER, 1, writer->file) != 1;
+    }
+    writer->failed |= fflush(writer->file) != 0;
+    free(writer->index);
+    pthread_mutex_destroy(&writer->lock);
+    return !writer->failed;
+}
+
+void startRecording(struct recording *recording, uint64_t seed) {
+    recording->seed = seed;
+    recording->moves = 0;
+    recording->failed = false;
+    if (recording->directions != NULL) {
+        memset(recording->directions, 0, recording->capacity / 4);
+    }
+}
+
+// the board is the one after the move and its spawn
+void recordMove(struct recording *recording, uint8_t direction,
+                const struct game *game, uint32_t checkpoint_moves) {
+    uint32_t j = recording->moves;
+    size_t capacity = recording->capacity > 0 ? 2 * recording->capacity : 1024;
+    uint8_t *directions, *checkpoints, *checkpoint;
+    if (recording->failed) {
+        return;
+    }
+    if (j == recording->capacity) {
+        directions = realloc(recording->directions, capacity / 4);
+        if (directions != NULL) {
+            memset(directions + j / 4, 0, (capacity - j) / 4);
+            recording->directions = directions;
+        }
+        // every move could have a checkpoint, when checkpoint_moves is 1
+        checkpoints = realloc(recording->checkpoints,
+                              capacity * ARCHIVE_CHECKPOINT);
+        if (checkpoints != NULL) {
+            recording->checkpoints = checkpoints;
+        }
+        if (directions == NULL || checkpoints == NULL) {
+            recording->failed = true;
+            return;
+        }
+        recording->capacity = capacity;
+    }
+    recording->directions[j / 4] |= direction << (2 * (j % 4));
+    recording->moves++;
+    if (checkpoint_moves > 0 && recording->moves % checkpoint_moves == 0) {
+        checkpoint = recording->checkpoints +
+                     (recording->moves / checkpoint_moves - 1) *
+                         ARCHIVE_CHECKPOINT;
+        putBytes(checkpoint, game->board, 8);
+        putBytes(checkpoint + 8, game->rng, 8);
+        putBytes(checkpoint + 16, game->score, 8);
+    }
+}
+
+void writeRecording(struct archive_writer *writer,
+                    const struct recording *recording, uint32_t score) {
+    static const uint8_t padding[8] = {0};
+    uint8_t header[ARCHIVE_RECORD];
+    size_t size = archiveRecordSize(recording->moves, writer->checkpoint_moves);
+    size_t directions = (recording->moves + 3) / 4;
+    size_t checkpoints = size - ARCHIVE_RECORD - (recording->moves + 31) / 32 * 8;
+    uint64_t *index;
+    putBytes(header, recording->seed, 8);
+    putBytes(header + 8, recording->moves, 4);
+    putBytes(header + 12, score, 4);
+    pthread_mutex_lock(&writer->lock);
+    if (writer->games == writer->capacity) {
+        writer->capacity = writer->capacity > 0 ? 2 * writer->capacity : 1024;
+        index = realloc(writer->index, writer->capacity * sizeof(uint64_t));
+        if (index == NULL) {
+            writer->failed = true;
+        }
+        writer->index = index != NULL ? index : writer->index;
+    }
+    writer->failed |= recording->failed;
+    if (!writer->failed) {
+        writer->failed =
+            fwrite(header, ARCHIVE_RECORD, 1, writer->file) != 1 ||
+            fwrite(recording->directions, 1, directions, writer->file) !=
+                directions ||
+            fwrite(padding, 1, (8 - directions % 8) % 8, writer->file) !=
+                (8 - directions % 8) % 8 ||
+            fwrite(recording->checkpoints, 1, checkpoints, writer->file) !=
+                checkpoints;
+        writer->index[writer->games++] = writer->offset;
+        writer->offset += size;
+    }
+    pthread_mutex_unlock(&writer->lock);
+}
+
+int compareDoubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// The statistics of a batch are gathered while it plays, in memory that does
+// not grow with the number of games. Every measure keeps its running mean and
+// variance (Welford) and a sketch of its distribution: the values are counted
+// in buckets whose bounds grow by SKETCH_GAMMA, so that any quantile it gives
+// is within 1% of the real one (DDSketch). Both merge exactly, every worker
+// keeps its own and they are added up when the batch is done.
+#define SKETCH_GAMMA 1.02
+#define SKETCH_BUCKETS 2048 // up to 1.02^2048, about 10^17
+
+struct measure {
+    uint64_t count;
+    double mean;
+    double m2; // the sum of the squared differences from the mean
+    double min, max;
+    uint64_t zeros; // the buckets start at 1
+    uint64_t buckets[SKETCH_BUCKETS];
+};
+
+struct batch_stats {
+    uint64_t games;
+    uint64_t moves;
+    uint64_t rollouts;
+    uint64_t max_tiles[TILE_VALUES]; // the games by their highest tile
+    struct measure score;
+    struct measure length;   // in moves
+    struct measure duration; // in microseconds
+};
+
+void initMeasure(struct measure *measure) {
+    memset(measure, 0, sizeof(struct measure));
+    measure->min = INFINITY;
+    measure->max = -INFINITY;
+}
+
+void initBatchStats(struct batch_stats *stats) {
+    memset(stats, 0, sizeof(struct batch_stats));
+    initMeasure(&stats->score);
+    initMeasure(&stats->length);
+    initMeasure(&stats->duration);
+}
+
+// a value from 1 up falls in the first bucket with a bound of at least it
+uint32_t sketchBucket(double value) {
+    double bucket = ceil(log(value) / log(SKETCH_GAMMA));
+    if (bucket < 0) {
+        return 0;
+    }
+    return bucket < SKETCH_BUCKETS ? bucket : SKETCH_BUCKETS - 1;
+}
+
+void addMeasure(struct measure *measure, double value) {
+    double delta = value - measure->mean;
+    measure->count++;
+    measure->mean += delta / measure->count;
+    measure->m2 += delta * (value - measure->mean);
+    if (value < measure->min) {
+        measure->min = value;
+    }
+    if (value > measure->max) {
+        measure->max = value;
+    }
+    if (value <= 0) {
+        measure->zeros++;
+    } else {
+        measure->buckets[sketchBucket(value)]++;
+    }
+}
+
+// adds the values of from to into, the means and variances as Chan et al.
+void mergeMeasure(struct measure *into, const struct measure *from) {
+    uint64_t count = into->count + from->count;
+    double delta = from->mean - into->mean;
+    uint32_t i;
+    if (from->count == 0) {
+        return;
+    }
+    into->mean += delta * from->count / count;
+    into->m2 += from->m2 + delta * delta * into->count * from->count / count;
+    into->count = count;
+    if (from->min < into->min) {
+        into->min = from->min;
+    }
+    if (from->max > into->max) {
+        into->max = from->max;
+    }
+    into->zeros += from->zeros;
+    for (i = 0; i < SKETCH_BUCKETS; i++) {
+        into->buckets[i] += from->buckets[i];
+    }
+}
+
+double measureDeviation(const struct measure *measure) {
+    return measure->count > 1 ? sqrt(measure->m2 / (measure->count - 1)) : 0;
+}
+
+// the value with rank q * (count - 1) among the values, for q from 0 to 1,
+// estimated as the middle of its bucket
+double measureQuantile(const struct measure *measure, double q) {
+    uint64_t rank = q * (measure->count - 1), seen = measure->zeros;
+    double value;
+    uint32_t i;
+    if (measure->count == 0) {
+        return 0;
+    }
+    if (rank < seen) {
+        return 0;
+    }
+    for (i = 0; i < SKETCH_BUCKETS - 1; i++) {
+        seen += measure->buckets[i];
+        if (rank < seen) {
+            break;
+        }
+    }
+    value = 2 * pow(SKETCH_GAMMA, i) / (SKETCH_GAMMA + 1);
+    if (value < measure->min) {
+        return measure->min;
+    }
+    return value > measure->max ? measure->max : value;
+}
+
+void addGame(struct batch_stats *stats, uint32_t score, uint64_t moves,
+             uint64_t ns, uint8_t max_tile) {
+    stats->games++;
+    stats->moves += moves;
+    stats->max_tiles[max_tile < TILE_VALUES ? max_tile : TILE_VALUES - 1]++;
+    addMeasure(&stats->score, score);
+    addMeasure(&stats->length, moves);
+    addMeasure(&stats->duration, ns / 1e3);
+}
+
+void mergeBatchStats(struct batch_stats *into, const struct batch_stats *from) {
+    uint8_t i;
+    into->games += from->games;
+    into->moves += from->moves;
+    into->rollouts += from->rollouts;
+    for (i = 0; i < TILE_VALUES; i++) {
+        into->max_tiles[i] += from->max_tiles[i];
+    }
+    mergeMeasure(&into->score, &from->score);
+    mergeMeasure(&into->length, &from->length);
+    mergeMeasure(&into->duration, &from->duration);
+}
+
+// every worker plays its own games with its own player and random state and
+// only writes its result when it is done, so the threads share nothing but
+// the counts of the games played for the progress reports
+struct batch_worker {
+    pthread_t thread;
+    struct player player;
+    rng_t rng;
+    uint32_t games;
+    struct batch_stats stats;
+    struct score_store *scores; // NULL when the games are not recorded
+    uint8_t size;
+    struct profile *profile; // of this thread
+    struct archive_writer *archive; // NULL when the games are not archived
+    struct recording recording;
+    volatile uint32_t played;
+    volatile uint64_t total_score;
+};
+
+void finishBatchGame(struct batch_worker *worker, uint32_t score,
+                     uint64_t moves, uint64_t start, uint8_t max_tile) {
+    addGame(&worker->stats, score, moves, getNanoseconds() - start, max_tile);
+    worker->total_score += score;
+    worker->played++;
+}
+
+// plays the games of a worker on a board of another size than 4x4
+void playSizedGames(struct batch_worker *worker) {
+    struct player *player = &worker->player;
+    struct sized_game game;
+    uint64_t start, moves;
+    uint32_t i;
+    uint8_t c, n = worker->size, max_tile;
+
+    game.rng = worker->rng;
+    for (i = 0; i < worker->games; i++) {
+        start = getNanoseconds();
+        moves = 0;
+        sizedGameInit(&game, n);
+        while (!game.kernels->game_ended(game.cells)) {
+            game.kernels->move(game.cells, player->sized_move(player, &game),
+                               &game.score);
+            game.kernels->add_random(game.cells, &game.rng);
+            moves++;
+        }
+        max_tile = 0;
+        for (c = 0; c < n * n; c++) {
+            if (game.cells[c] > max_tile) {
+                max_tile = game.cells[c];
+            }
+        }
+        finishBatchGame(worker, game.score, moves, start, max_tile);
+    }
+}
+
+void *runBatchWorker(void *arg) {
+    struct batch_worker *worker = arg;
+    struct player *player = &worker->player;
+    struct game game = {0, 0, worker->rng, 0, 0};
+    struct profile *profile = worker->profile;
+    uint64_t start, game_start, moves;
+    uint32_t i;
+    uint8_t tile, max_tile, direction;
+    bool over;
+
+    initBatchStats(&worker->stats);
+    if (worker->size != SIZE) {
+        playSizedGames(worker);
+        return NULL;
+    }
+    for (i = 0; i < worker->games; i++) {
+        game_start = getNanoseconds();
+        moves = 0;
+        if (worker->archive != NULL) {
+            startRecording(&worker->recording, game.rng);
+        }
+        gameInit(&game);
+        while (true) {
+            start = profileClock();
+            over = gameIsOver(&game);
+            profilePhase(profile, PHASE_OVER, start);
+            if (over) {
+                break;
+            }
+            start = profileClock();
+            direction = player->move(player, game.board);
+            profilePhase(profile, PHASE_THINK, start);
+            start = profileClock();
+            gameMove(&game, direction);
+            profilePhase(profile, PHASE_MOVE, start);
+            start = profileClock();
+            gameAddRandom(&game);
+            profilePhase(profile, PHASE_SPAWN, start);
+            if (worker->archive != NULL) {
+                recordMove(&worker->recording, direction, &game,
+                           worker->archive->checkpoint_moves);
+            }
+            moves++;
+        }
+        if (worker->scores != NULL) {
+            recordScore(worker->scores, game.score);
+        }
+        if (worker->archive != NULL) {
+            writeRecording(worker->archive, &worker->recording, game.score);
+        }
+        max_tile = 0;
+        for (; game.board; game.board >>= 4) {
+            tile = game.board & 0xf;
+            if (tile > max_tile) {
+                max_tile = tile;
+            }
+        }
+        finishBatchGame(worker, game.score, moves, game_start, max_tile);
+    }
+    worker->stats.rollouts = player->rollouts;
+    free(worker->recording.directions);
+    free(worker->recording.checkpoints);
+    return NULL;
+}
+
+// reports on stderr how far the workers are, every interval seconds until
+// they played all the games
+void reportProgress(struct batch_worker *workers, uint32_t threads,
+                    uint32_t games, uint32_t interval, double start) {
+    struct timespec pause = {0, 50000000};
+    double next = start + interval, now;
+    uint64_t total_score;
+    uint32_t i, played = 0;
+
+    while (played < games) {
+        nanosleep(&pause, NULL);
+        now = getSeconds();
+        played = 0;
+        total_score = 0;
+        for (i = 0; i < threads; i++) {
+            played += workers[i].played;
+            total_score += workers[i].total_score;
+        }
+        if (now >= next && played < games) {
+            fprintf(stderr, "progress: %u/%u games, %.0f games/s, mean %.1f\n",
+                    played, games, played / (now - start),
+                    played > 0 ? (double)total_score / played : 0);
+            next += interval;
+        }
+    }
+}
+
+// the statistics as name,value lines or as a json object of the same names
+void printStat(bool json, bool first, const char *name, double value) {
+    if (json) {
+        printf("%s\n  \"%s\": %.10g", first ? "{" : ",", name, value);
+    } else {
+        printf("%s,%.10g\n", name, value);
+    }
+}
+
+void printMeasure(bool json, const char *name, const struct measure *measure) {
+    static const struct {
+        const char *name;
+        double q;
+    } quantiles[] = {{"p50", 0.5}, {"p90", 0.9}, {"p99", 0.99}};
+    char stat[64];
+    uint8_t i;
+    snprintf(stat, sizeof(stat), "%s_mean", name);
+    printStat(json, false, stat, measure->mean);
+    snprintf(stat, sizeof(stat), "%s_sd", name);
+    printStat(json, false, stat, measureDeviation(measure));
+    snprintf(stat, sizeof(stat), "%s_min", name);
+    printStat(json, false, stat, measure->min);
+    for (i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); i++) {
+        snprintf(stat, sizeof(stat), "%s_%s", name, quantiles[i].name);
+        printStat(json, false, stat, measureQuantile(measure, quantiles[i].q));
+    }
+    snprintf(stat, sizeof(stat), "%s_max", name);
+    printStat(json, false, stat, measure->max);
+}
+
+void printBatchData(bool json, const struct batch_stats *stats,
+                    double seconds) {
+    char stat[64];
+    uint8_t i;
+    if (!json) {
+        printf("name,value\n");
+    }
+    printStat(json, true, "games", stats->games);
+    printStat(json, false, "moves", stats->moves);
+    printStat(json, false, "seconds", seconds);
+    printStat(json, false, "games_per_s", stats->games / seconds);
+    printStat(json, false, "moves_per_s", stats->moves / seconds);
+    if (stats->rollouts > 0) {
+        printStat(json, false, "rollouts_per_s", stats->rollouts / seconds);
+    }
+    printMeasure(json, "score", &stats->score);
+    printMeasure(json, "length", &stats->length);
+    printMeasure(json, "duration_us", &stats->duration);
+    for (i = 1; i < TILE_VALUES; i++) {
+        if (stats->max_tiles[i] > 0) {
+            snprintf(stat, sizeof(stat), "max_tile_%llu", 1ULL << i);
+            printStat(json, false, stat, stats->max_tiles[i]);
+        }
+    }
+    if (json) {
+        printf("\n}\n");
+    }
+}
+
+void printBatchText(const struct batch_stats *stats, const char *name,
+                    uint8_t size, uint32_t threads, double seconds) {
+    const struct measure *score = &stats->score;
+    const struct measure *length = &stats->length;
+    const struct measure *duration = &stats->duration;
+    uint8_t i, max_tile = 0;
+
+    printf("games:    %llu (%s, %ux%u, %u threads)\n",
+           (unsigned long long)stats->games, name, size, size, threads);
+    printf("moves:    %llu\n", (unsigned long long)stats->moves);
+    printf("time:     %.3f s\n", seconds);
+    printf("games/s:  %.2f\n", stats->games / seconds);
+    printf("moves/s:  %.0f\n", stats->moves / seconds);
+    printf("score:    mean %.1f, sd %.1f, min %.0f, max %.0f\n", score->mean,
+           measureDeviation(score), score->min, score->max);
+    printf("          p50 %.0f, p90 %.0f, p99 %.0f\n",
+           measureQuantile(score, 0.5), measureQuantile(score, 0.9),
+           measureQuantile(score, 0.99));
+    printf("length:   mean %.1f, p50 %.0f, p99 %.0f moves\n", length->mean,
+           measureQuantile(length, 0.5), measureQuantile(length, 0.99));
+    printf("duration: mean %.1f, p50 %.1f, p99 %.1f us\n", duration->mean,
+           measureQuantile(duration, 0.5), measureQuantile(duration, 0.99));
+    for (i = 0; i < TILE_VALUES; i++) {
+        if (stats->max_tiles[i] > 0) {
+            max_tile = i;
+        }
+    }
+    printf("max tile: %llu\n", 1ULL << max_tile);
+    for (i = 1; i <= max_tile; i++) {
+        if (stats->max_tiles[i] > 0) {
+            printf("%8llu: %5.1f%%\n", 1ULL << i,
+                   100.0 * stats->max_tiles[i] / stats->games);
+        }
+    }
+    if (stats->rollouts > 0) {
+        printf("rollouts/s: %.0f\n", stats->rollouts / seconds);
+    }
+}
+
+// plays the games without a terminal, as fast as the engine allows, split
+// over the given number of threads
+int batch(struct options *options) {
+    static struct score_store scores;
+    static struct archive_writer archive;
+    FILE *archive_file = NULL;
+    struct batch_worker *workers;
+    // the profiles are printed when the process exits, they are kept till then
+    struct profile *profiles = NULL;
+    struct batch_stats total;
+    struct player_settings settings = options->player;
+    uint32_t i, started, games = options->batch_games;
+    uint32_t threads = options->threads;
+    uint8_t size = options->size;
+    bool record = options->record_batch;
+    char *format = options->batch_format;
+    double start, seconds;
+    rng_t seeds = time(NULL);
+
+    if (strcmp(format, "text") != 0 && strcmp(format, "csv") != 0 &&
+        strcmp(format, "json") != 0) {
+        printf("Error! Unknown batch format %s.\n", format);
+        return EXIT_FAILURE;
+    }
+    if (threads == 0) {
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (threads > games) {
+        threads = games;
+    }
+    workers = calloc(threads, sizeof(struct batch_worker));
+    if (profiling) {
+        profiles = calloc(threads, sizeof(struct profile));
+    }
+    if (workers == NULL || (profiling && profiles == NULL)) {
+        printf("Error!");
+        free(workers);
+        return EXIT_FAILURE;
+    }
+    // the searches of all workers share what they found
+    if (strcmp(settings.name, "expectimax") == 0 && threads > 1) {
+        settings.shared_tt = newTable();
+        if (settings.shared_tt == NULL) {
+            printf("Error allocating the transposition table!\n");
+            free(workers);
+            free(profiles);
+            return EXIT_FAILURE;
+        }
+    }
+    for (started = 0; started < threads; started++) {
+        if (!initPlayer(&workers[started].player, &settings,
+                        rngNext(&seeds))) {
+            break;
+        }
+        if (size != SIZE && workers[started].player.sized_move == NULL) {
+            printf("The %s player only plays on a 4x4 board!\n",
+                   settings.name);
+            freePlayer(&workers[started].player);
+            break;
+        }
+    }
+    if (started < threads) {
+        for (i = 0; i < started; i++) {
+            freePlayer(&workers[i].player);
+        }
+        free(workers);
+        free(profiles);
+        free(settings.shared_tt);
+        return EXIT_FAILURE;
+    }
+
+    if (options->archive != NULL) {
+        archive_file = fopen(options->archive, "wb");
+    }
+    if (options->archive != NULL && archive_file == NULL) {
+        printf("Error opening %s for writing!\n", options->archive);
+        for (i = 0; i < threads; i++) {
+            freePlayer(&workers[i].player);
+        }
+        free(workers);
+        free(profiles);
+        free(settings.shared_tt);
+        return EXIT_FAILURE;
+    }
+    if (archive_file != NULL) {
+        openArchiveWriter(&archive, archive_file, options->archive_checkpoints);
+    }
+    if (record) {
+        openScoreStore(&scores);
+    }
+    thread_profiles = profiles;
+    thread_profile_count = profiles != NULL ? threads : 0;
+    initBatchStats(&total);
+    start = getSeconds();
+    for (i = 0; i < threads; i++) {
+        // every worker starts somewhere else in the sequence
+        workers[i].rng = rngNext(&seeds);
+        workers[i].scores = record ? &scores : NULL;
+        workers[i].size = size;
+        workers[i].profile = profiles != NULL ? &profiles[i] : NULL;
+        workers[i].archive = options->archive != NULL ? &archive : NULL;
+        workers[i].games = games / threads + (i < games % threads);
+        pthread_create(&workers[i].thread, NULL, runBatchWorker, &workers[i]);
+    }
+    if (options->progress_s > 0) {
+        reportProgress(workers, threads, games, options->progress_s, start);
+    }
+    for (i = 0; i < threads; i++) {
+        pthread_join(workers[i].thread, NULL);
+        freePlayer(&workers[i].player);
+        mergeBatchStats(&total, &workers[i].stats);
+    }
+    seconds = getSeconds() - start;
+    free(workers);
+    free(settings.shared_tt);
+    if (record) {
+        closeScoreStore(&scores);
+    }
+    if (archive_file != NULL &&
+        (!closeArchiveWriter(&archive) | (fclose(archive_file) != 0))) {
+        printf("Error writing %s!\n", options->archive);
+        return EXIT_FAILURE;
+    }
+
+    if (strcmp(format, "text") == 0) {
+        printBatchText(&total, options->player.name, size, threads, seconds);
+    } else {
+        printBatchData(strcmp(format, "json") == 0, &total, seconds);
+    }
+    return EXIT_SUCCESS;
+}
+
+// replays every game of an archive from its seed, and checks the checkpoints
+// and the final score on the way
+int checkArchive(char *path) {
+    struct archive archive;
+    struct archive_game game;
+    struct game state, seeked;
+    uint64_t i, moves = 0;
+    uint32_t j, checks = 0, failures = 0;
+    double start = getSeconds(), seconds;
+    bool valid;
+
+    if (!openArchive(&archive, path)) {
+        printf("Error reading the archive %s!\n", path);
+        return EXIT_FAILURE;
+    }
+    for (i = 0; i < archive.games; i++) {
+        checks++;
+        if (!archiveGame(&archive, i, &game)) {
+            failures++;
+            continue;
+        }
+        state.rng = game.seed;
+        gameInit(&state);
+        valid = true;
+        for (j = 0; j < game.moves && valid; j++) {
+            valid = gameMove(&state, archiveMove(&game, j));
+            gameAddRandom(&state);
+            if (game.checkpoint_moves > 0 &&
+                (j + 1) % game.checkpoint_moves == 0) {
+                archiveSeek(&game, j + 1, &seeked);
+                valid &= seeked.board == state.board &&
+                         seeked.rng == state.rng &&
+                         seeked.score == state.score;
+            }
+        }
+        moves += game.moves;
+        if (!valid || !gameIsOver(&state) || state.score != game.score) {
+            printf("game %llu: no match at move %u\n", (unsigned long long)i,
+                   j);
+            failures++;
+        }
+    }
+    seconds = getSeconds() - start;
+    printf("games:    %llu\n", (unsigned long long)archive.games);
+    printf("moves:    %llu\n", (unsigned long long)moves);
+    printf("moves/s:  %.0f\n", moves / seconds);
+    printf("checks:   %u passed, %u failed\n", checks - failures, failures);
+    closeArchive(&archive);
+    return failures > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// The spawns of a game follow from its seed alone, so the seeds of one
+// position can be ranked by how well a player does on them. The explorer
+// plays every seed of a range for up to horizon moves and keeps the seeds
+// with the highest and the lowest scores: the easy and the hard scenarios.
+// Every worker owns a part of the range and takes a chunk of it at a time;
+// a worker that runs out steals the upper half of the largest part left. A
+// part is one word, the next seed in the low half and the end in the high
+// half, that is only changed with compare and swap.
+#define EXPLORE_CHUNK 64
+#define TOP_SEEDS 10
+
+struct seed_result {
+    uint32_t seed;
+    uint32_t score;
+    uint32_t moves;
+};
+
+struct explore_worker {
+    pthread_t thread;
+    struct player player;
+    uint64_t range;
+    struct seed_result best[TOP_SEEDS], worst[TOP_SEEDS];
+    uint32_t best_count, worst_count;
+    uint64_t explored;
+    struct explorer *explorer;
+};
+
+struct explorer {
+    board_t board; // 0 to start every game from its seed
+    uint32_t seeds;
+    uint32_t horizon; // moves per seed
+    uint32_t target; // the score that ends the search, 0 for none
+    uint32_t threads;
+    struct player_settings *settings;
+    struct explore_worker *workers;
+    bool found; // a seed reached the target
+    struct seed_result best[TOP_SEEDS], worst[TOP_SEEDS];
+    uint32_t best_count, worst_count;
+    uint64_t explored;
+};
+
+uint64_t packRange(uint32_t next, uint32_t end) {
+    return (uint64_t)end << 32 | next;
+}
+
+// whether a ranks above b, the lower seed first when they score the same
+bool betterSeed(const struct seed_result *a, const struct seed_result *b) {
+    return a->score > b->score || (a->score == b->score && a->seed < b->seed);
+}
+
+// keeps the TOP_SEEDS results that come first, better or worse ones
+void rankSeed(struct seed_result *top, uint32_t *count,
+              const struct seed_result *result, bool better) {
+    uint32_t i;
+    if (*count == TOP_SEEDS &&
+        betterSeed(result, &top[TOP_SEEDS - 1]) != better) {
+        return;
+    }
+    i = *count < TOP_SEEDS ? (*count)++ : TOP_SEEDS - 1;
+    for (; i > 0 && betterSeed(result, &top[i - 1]) == better; i--) {
+        top[i] = top[i - 1];
+    }
+    top[i] = *result;
+}
+
+// takes the next chunk of the own range, or steals half of another one
+bool takeSeeds(struct explore_worker *worker, uint32_t *first,
+               uint32_t *end) {
+    struct explorer *explorer = worker->explorer;
+    struct explore_worker *victim;
+    uint64_t range;
+    uint32_t next, last, size, i, largest;
+
+    while (true) {
+        range = __atomic_load_n(&worker->range, __ATOMIC_ACQUIRE);
+        next = range;
+        last = range >> 32;
+        if (next >= last) {
+            break;
+        }
+        size = last - next < EXPLORE_CHUNK ? last - next : EXPLORE_CHUNK;
+        if (__atomic_compare_exchange_n(&worker->range, &range,
+                                        packRange(next + size, last), false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            *first = next;
+            *end = next + size;
+            return true;
+        }
+    }
+    while (!__atomic_load_n(&explorer->found, __ATOMIC_RELAXED)) {
+        victim = NULL;
+        largest = 1;
+        for (i = 0; i < explorer->threads; i++) {
+            range = __atomic_load_n(&explorer->workers[i].range,
+                                    __ATOMIC_ACQUIRE);
+            size = (uint32_t)(range >> 32) - (uint32_t)range;
+            if ((uint32_t)range < range >> 32 && size > largest) {
+                victim = &explorer->workers[i];
+                largest = size;
+            }
+        }
+        // the parts that are left are too small to split
+        if (victim == NULL) {
+            return false;
+        }
+        range = __atomic_load_n(&victim->range, __ATOMIC_ACQUIRE);
+        next = range;
+        last = range >> 32;
+        if (next + 1 >= last) {
+            continue;
+        }
+        size = (last - next) / 2;
+        if (__atomic_compare_exchange_n(&victim->range, &range,
+                                        packRange(next, last - size), false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            // the stolen part becomes the own one, that others steal from
+            __atomic_store_n(&worker->range, packRange(last - size, last),
+                             __ATOMIC_RELEASE);
+            return takeSeeds(worker, first, end);
+        }
+    }
+    return false;
+}
+
+void exploreSeed(struct explore_worker *worker, uint32_t seed,
+                 struct seed_result *result) {
+    struct explorer *explorer = worker->explorer;
+    struct player *player = &worker->player;
+    struct game game = {explorer->board, 0, seed, 0, 0};
+
+    // a random player plays the same on a seed whatever thread has it
+    player->rng = seed ^ 0x9E3779B97F4A7C15ULL;
+    if (explorer->board == 0) {
+        gameInit(&game);
+    } else {
+        gameRefresh(&game);
+    }
+    result->seed = seed;
+    for (result->moves = 0; result->moves < explorer->horizon &&
+                            !gameIsOver(&game);
+         result->moves++) {
+        gameMove(&game, player->move(player, game.board));
+        gameAddRandom(&game);
+        if (explorer->target > 0 && game.score >= explorer->target) {
+            result->moves++;
+            break;
+        }
+    }
+    result->score = game.score;
+}
+
+void *runExploreWorker(void *arg) {
+    struct explore_worker *worker = arg;
+    struct explorer *explorer = worker->explorer;
+    struct seed_result result;
+    uint32_t seed, end;
+
+    while (takeSeeds(worker, &seed, &end)) {
+        for (; seed < end; seed++) {
+            if (__atomic_load_n(&explorer->found, __ATOMIC_RELAXED)) {
+                return NULL;
+            }
+            exploreSeed(worker, seed, &result);
+            worker->explored++;
+            rankSeed(worker->best, &worker->best_count, &result, true);
+            rankSeed(worker->worst, &worker->worst_count, &result, false);
+            if (explorer->target > 0 && result.score >= explorer->target) {
+                __atomic_store_n(&explorer->found, true, __ATOMIC_RELAXED);
+            }
+        }
+    }
+    return NULL;
+}
+
+// plays the seeds from 0 up and ranks them, false when the players failed
+bool runExplorer(struct explorer *explorer) {
+    struct explore_worker *workers;
+    uint32_t i, j, started, seeds = explorer->seeds;
+    rng_t rng = 1;
+
+    if (explorer->threads > seeds) {
+        explorer->threads = seeds;
+    }
+    workers = calloc(explorer->threads, sizeof(struct explore_worker));
+    if (workers == NULL) {
+        return false;
+    }
+    for (started = 0; started < explorer->threads; started++) {
+        if (!initPlayer(&workers[started].player, explorer->settings,
+                        rngNext(&rng))) {
+            break;
+        }
+    }
+    if (started < explorer->threads) {
+        for (i = 0; i < started; i++) {
+            freePlayer(&workers[i].player);
+        }
+        free(workers);
+        return false;
+    }
+    explorer->workers = workers;
+    explorer->found = false;
+    for (i = 0; i < explorer->threads; i++) {
+        workers[i].explorer = explorer;
+        workers[i].range =
+            packRange((uint64_t)seeds * i / explorer->threads,
+                      (uint64_t)seeds * (i + 1) / explorer->threads);
+    }
+    for (i = 0; i < explorer->threads; i++) {
+        pthread_create(&workers[i].thread, NULL, runExploreWorker,
+                       &workers[i]);
+    }
+    explorer->best_count = explorer->worst_count = 0;
+    explorer->explored = 0;
+    for (i = 0; i < explorer->threads; i++) {
+        pthread_join(workers[i].thread, NULL);
+        freePlayer(&workers[i].player);
+        explorer->explored += workers[i].explored;
+        for (j = 0; j < workers[i].best_count; j++) {
+            rankSeed(explorer->best, &explorer->best_count,
+                     &workers[i].best[j], true);
+        }
+        for (j = 0; j < workers[i].worst_count; j++) {
+            rankSeed(explorer->worst, &explorer->worst_count,
+                     &workers[i].worst[j], false);
+        }
+    }
+    free(workers);
+    explorer->workers = NULL;
+    return true;
+}
+
+void printSeeds(const char *title, const struct seed_result *results,
+                uint32_t count) {
+    uint32_t i;
+    printf("%s\n", title);
+    for (i = 0; i < count; i++) {
+        printf("%10u %10u %6u\n", results[i].seed, results[i].score,
+               results[i].moves);
+    }
+}
+
+int explore(struct options *options) {
+    struct explorer explorer;
+    double start, seconds;
+
+    memset(&explorer, 0, sizeof(struct explorer));
+    explorer.board = options->board;
+    explorer.seeds = options->explore_seeds;
+    explorer.horizon = options->horizon > 0 ? options->horizon : UINT32_MAX;
+    explorer.target = options->target;
+    explorer.threads = options->threads > 0
+                           ? options->threads
+                           : (uint32_t)sysconf(_SC_NPROCESSORS_ONLN);
+    explorer.settings = &options->player;
+    start = getSeconds();
+    if (!runExplorer(&explorer)) {
+        return EXIT_FAILURE;
+    }
+    seconds = getSeconds() - start;
+    printf("seeds:    %llu of %u (%s, %u threads)\n",
+           (unsigned long long)explorer.explored, explorer.seeds,
+           options->player.name, explorer.threads);
+    printf("time:     %.3f s\n", seconds);
+    printf("seeds/s:  %.0f\n", explorer.explored / seconds);
+    if (explorer.found) {
+        printf("target:   %u reached\n", explorer.target);
+    }
+    printSeeds("easiest:        seed      score  moves", explorer.best,
+               explorer.best_count);
+    printSeeds("hardest:        seed      score  moves", explorer.worst,
+               explorer.worst_count);
+    return EXIT_SUCCESS;
+}
+
+// Agents play over a pipe (--pipe, stdin and stdout) or over connections to
+// a socket (--listen), with a line per request, each of them naming the game
+// it is about so that one connection can play any number of games:
+//   n <game> <seed>   starts game number <game> from the seed
+//   m <game> <moves>  moves it, a letter per move (u, d, l or r), every move
+//                     that changes the board spawns a tile
+//   s <game>          asks for the game
+//   q                 closes the connection
+// Every request but q gets the line "<game> <board> <score> <over>" back,
+// with the packed board in hex, or "error <reason>". Replies are collected
+// until every request that arrived is answered, and then written at once.
+// The sockets do not block: a client that does not read its replies keeps
+// them buffered, and its requests wait until there is room for theirs.
+#define SERVE_INPUT 65536
+#define SERVE_OUTPUT 65536
+#define SERVE_REPLY 96
+#define SERVE_GAMES (1 << 20) // the game numbers of a connection
+#define SERVE_CONNECTIONS 1024
+
+struct connection {
+    int in, out;
+    char input[SERVE_INPUT];
+    uint32_t input_length;
+    char output[SERVE_OUTPUT];
+    uint32_t output_length;
+    struct game *games; // a game that has not started has no tiles
+    uint32_t game_count;
+};
+
+struct connection *newConnection(int in, int out) {
+    struct connection *connection = malloc(sizeof(struct connection));
+    if (connection != NULL) {
+        connection->in = in;
+        connection->out = out;
+        connection->input_length = 0;
+        connection->output_length = 0;
+        connection->games = NULL;
+        connection->game_count = 0;
+    }
+    return connection;
+}
+
+void freeConnection(struct connection *connection) {
+    free(connection->games);
+    free(connection);
+}
+
+// writes the replies, on a socket that would block the rest stays buffered
+bool flushConnection(struct connection *connection) {
+    uint32_t written = 0;
+    ssize_t result;
+    while (written < connection->output_length) {
+        result = write(connection->out, connection->output + written,
+                       connection->output_length - written);
+        if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        if (result <= 0) {
+            return false;
+        }
+        written += result;
+    }
+    memmove(connection->output, connection->output + written,
+            connection->output_length - written);
+    connection->output_length -= written;
+    return true;
+}
+
+// returns the game with the given number, NULL when there is no memory
+struct game *findGame(struct connection *connection, uint32_t number) {
+    uint32_t count = connection->game_count;
+    struct game *games;
+    if (number >= SERVE_GAMES) {
+        return NULL;
+    }
+    if (number >= count) {
+        for (count = count > 0 ? count : 16; count <= number; count *= 2) {
+        }
+        games = realloc(connection->games, count * sizeof(struct game));
+        if (games == NULL) {
+            return NULL;
+        }
+        memset(games + connection->game_count, 0,
+               (count - connection->game_count) * sizeof(struct game));
+        connection->games = games;
+        connection->game_count = count;
+    }
+    return &connection->games[number];
+}
+
+// answers one request, returns false when the connection is to be closed
+bool serveRequest(struct connection *connection, char *line) {
+    char reply[SERVE_REPLY], *end, *moves = "";
+    unsigned long number;
+    unsigned long long seed = 0;
+    struct game *game;
+    uint8_t direction;
+    char command = line[0];
+
+    if (command == 'q') {
+        return false;
+    }
+    number = strtoul(line + 1, &end, 10);
+    if (command == 'n') {
+        seed = strtoull(end, &end, 10);
+    } else if (command == 'm') {
+        for (moves = end; *moves == ' '; moves++) {
+        }
+    }
+    game = end != line + 1 ? findGame(connection, number) : NULL;
+    if (command != 'n' && command != 'm' && command != 's') {
+        snprintf(reply, sizeof(reply), "error unknown request\n");
+    } else if (end == line + 1) {
+        snprintf(reply, sizeof(reply), "error no game number\n");
+    } else if (game == NULL) {
+        snprintf(reply, sizeof(reply), "error no room for game %lu\n",
+                 number);
+    } else if (command != 'n' && game->board == 0) {
+        snprintf(reply, sizeof(reply), "error game %lu not started\n",
+                 number);
+    } else {
+        if (command == 'n') {
+            game->rng = seed;
+            gameInit(game);
+        }
+        for (; *moves != '\0' && !gameIsOver(game); moves++) {
+            switch (*moves) {
+                case 'u':
+                    direction = UP;
+                    break;
+                case 'd':
+                    direction = DOWN;
+                    break;
+                case 'l':
+                    direction = LEFT;
+                    break;
+                case 'r':
+                    direction = RIGHT;
+                    break;
+                default:
+                    continue;
+            }
+            if (gameMove(game, direction)) {
+                gameAddRandom(game);
+            }
+        }
+        snprintf(reply, sizeof(reply), "%lu %016llx %u %u\n", number,
+                 (unsigned long long)game->board, game->score,
+                 gameIsOver(game));
+    }
+    memcpy(connection->output + connection->output_length, reply,
+           strlen(reply));
+    connection->output_length += strlen(reply);
+    return true;
+}
+
+bool hasRequest(struct connection *connection) {
+    return memchr(connection->input, '\n', connection->input_length) != NULL;
+}
+
+// answers the complete requests that arrived while their replies fit and
+// writes them, until no request is left or the replies have to wait, returns
+// false when the connection is to be closed
+bool serveRequests(struct connection *connection) {
+    uint32_t start, i;
+    bool open = true;
+    do {
+        start = 0;
+        for (i = 0; i < connection->input_length && open &&
+                    connection->output_length + SERVE_REPLY <= SERVE_OUTPUT;
+             i++) {
+            if (connection->input[i] == '\n') {
+                connection->input[i] = '\0';
+                open = serveRequest(connection, connection->input + start);
+                start = i + 1;
+            }
+        }
+        // a request that does not fit in the buffer is dropped
+        if (start == 0 && connection->input_length == SERVE_INPUT &&
+            !hasRequest(connection)) {
+            start = SERVE_INPUT;
+        }
+        memmove(connection->input, connection->input + start,
+                connection->input_length - start);
+        connection->input_length -= start;
+        if (!flushConnection(connection)) {
+            return false;
+        }
+    } while (open && connection->output_length == 0 &&
+             hasRequest(connection));
+    return open;
+}
+
+// reads what arrived and answers the requests in it, returns false when the
+// connection is closed
+bool serveInput(struct connection *connection) {
+    ssize_t result;
+    result = read(connection->in, connection->input + connection->input_length,
+                  SERVE_INPUT - connection->input_length);
+    if (result <= 0) {
+        return false;
+    }
+    connection->input_length += result;
+    return serveRequests(connection);
+}
+
+int servePipe() {
+    struct connection *connection = newConnection(STDIN_FILENO, STDOUT_FILENO);
+    if (connection == NULL) {
+        printf("Error!");
+        return EXIT_FAILURE;
+    }
+    while (serveInput(connection)) {
+    }
+    freeConnection(connection);
+    return EXIT_SUCCESS;
+}
+
+// a number is a tcp port on the interface of bind, anything else a unix socket
+int listenTo(char *address, char *bind_address) {
+    struct sockaddr_in tcp = {0};
+    struct sockaddr_un local = {0};
+    char *end;
+    unsigned long port = strtoul(address, &end, 10);
+    int fd, yes = 1;
+    if (*end == '\0') {
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        tcp.sin_family = AF_INET;
+        tcp.sin_port = htons(port);
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+        if (fd < 0 ||
+            inet_pton(AF_INET, bind_address, &tcp.sin_addr) != 1 ||
+            bind(fd, (struct sockaddr *)&tcp, sizeof(tcp)) != 0) {
+            close(fd);
+            return -1;
+        }
+    } else {
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        local.sun_family = AF_UNIX;
+        snprintf(local.sun_path, sizeof(local.sun_path), "%s", address);
+        // the socket of a server that is gone is in the way
+        unlink(address);
+        if (fd < 0 ||
+            bind(fd, (struct sockaddr *)&local, sizeof(local)) != 0) {
+            close(fd);
+            return -1;
+        }
+    }
+    if (listen(fd, SOMAXCONN) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// one thread serves every connection, poll tells which of them have input or
+// can take the replies that wait
+int serveSocket(char *address, char *bind_address) {
+    static struct pollfd fds[SERVE_CONNECTIONS + 1];
+    static struct connection *connections[SERVE_CONNECTIONS];
+    uint32_t count = 0, i;
+    bool open;
+    int fd = listenTo(address, bind_address);
+    if (fd < 0) {
+        printf("Error listening to %s!\n", address);
+        return EXIT_FAILURE;
+    }
+    // a client that goes away while it gets its replies must not stop us
+    signal(SIGPIPE, SIG_IGN);
+    fds[0].fd = fd;
+    fds[0].events = POLLIN;
+    while (poll(fds, count + 1, -1) >= 0) {
+        for (i = 0; i < count; i++) {
+            if (fds[i + 1].revents == 0) {
+                continue;
+            }
+            open = fds[i + 1].events == POLLOUT
+                       ? serveRequests(connections[i])
+                       : serveInput(connections[i]);
+            // no more requests are read while the replies wait
+            fds[i + 1].events =
+                connections[i]->output_length > 0 ? POLLOUT : POLLIN;
+            if (!open) {
+                close(fds[i + 1].fd);
+                freeConnection(connections[i]);
+                // the last connection takes the place of the closed one
+                count--;
+                connections[i] = connections[count];
+                fds[i + 1] = fds[count + 1];
+                i--;
+            }
+        }
+        if (fds[0].revents != 0) {
+            fd = accept(fds[0].fd, NULL, NULL);
+            if (fd >= 0 && count < SERVE_CONNECTIONS &&
+                fcntl(fd, F_SETFL, O_NONBLOCK) == 0 &&
+                (connections[count] = newConnection(fd, fd)) != NULL) {
+                fds[count + 1].fd = fd;
+                fds[count + 1].events = POLLIN;
+                fds[count + 1].revents = 0;
+                count++;
+            } else if (fd >= 0) {
+                close(fd);
+            }
+        }
+    }
+    return EXIT_FAILURE;
+}
+
+// slides a column up the slow and obvious way, apart from the engines: the
+// tiles are gathered, equal neighbours merged once from the top, and the rest
+// of the column emptied
+bool referenceSlide(uint8_t *line, uint8_t n, uint32_t *score) {
+    uint8_t tiles[MAX_SIZE], slid[MAX_SIZE] = {0}, count = 0, i, k = 0;
+    bool success;
+    for (i = 0; i < n; i++) {
+        if (line[i] != 0) {
+            tiles[count++] = line[i];
+        }
+    }
+    for (i = 0; i < count; i++, k++) {
+        slid[k] = tiles[i];
+        if (i + 1 < count && tiles[i] == tiles[i + 1]) {
+            slid[k]++;
+            *score += (uint32_t)1 << slid[k];
+            i++;
+        }
+    }
+    success = memcmp(line, slid, n) != 0;
+    memcpy(line, slid, n);
+    return success;
+}
+
+// the moves the way the game first made them: the board is rotated so that
+// every direction becomes a slide up of its columns, and rotated back
+bool referenceMove(uint8_t *cells, uint8_t n, uint8_t direction,
+                   uint32_t *score) {
+    uint8_t rotations[] = {0, 2, 1, 3}, i, x;
+    bool success = false;
+    for (i = 0; i < rotations[direction]; i++) {
+        rotateCells(cells, n);
+    }
+    for (x = 0; x < n; x++) {
+        success |= referenceSlide(cells + n * x, n, score);
+    }
+    for (i = rotations[direction]; i % 4 != 0; i++) {
+        rotateCells(cells, n);
+    }
+    return success;
+}
+
+// The differential test runs every line in every direction, inside otherwise
+// random boards, and then as many random boards through the reference moves
+// above and every faster engine, FUZZ_BLOCK cases at a time. Every engine
+// keeps two 32768 tiles apart, and so does the reference once each 32768 has
+// a value of its own.
+#define FUZZ_LINES (4 << 16)
+#define FUZZ_CASES (FUZZ_LINES + (1 << 16))
+#define FUZZ_BLOCK 4096
+
+struct fuzz_block {
+    board_t inputs[FUZZ_BLOCK];
+    uint8_t directions[FUZZ_BLOCK];
+    board_t expected[FUZZ_BLOCK];
+    uint32_t expected_scores[FUZZ_BLOCK];
+    uint8_t expected_moved[FUZZ_BLOCK];
+    uint8_t expected_empty[FUZZ_BLOCK];
+    uint8_t expected_ended[FUZZ_BLOCK];
+    board_t boards[FUZZ_BLOCK];
+    uint32_t scores[FUZZ_BLOCK];
+    uint8_t moved[FUZZ_BLOCK];
+    uint8_t empty[FUZZ_BLOCK];
+    uint8_t ended[FUZZ_BLOCK];
+    uint32_t count;
+};
+
+// fills the block with the cases from first on, returns false when done
+bool nextFuzzBlock(struct fuzz_block *block, uint32_t first, rng_t *rng) {
+    uint8_t cells[SIZE][SIZE], x, y, i;
+    uint32_t n, line;
+    board_t board;
+    block->count = 0;
+    for (n = first; n < FUZZ_CASES && block->count < FUZZ_BLOCK; n++) {
+        // clear about half of the bits so empty cells and pairs are common
+        board = rngNext(rng) & (rngNext(rng) | rngNext(rng));
+        block->directions[block->count] = rngBelow(rng, 4);
+        if (n < FUZZ_LINES) {
+            block->directions[block->count] = n % 4;
+            line = n / 4;
+            for (i = 0; i < SIZE; i++) {
+                board &= ~(0xfULL << lineShift(n % 4, 0, i));
+                board |= (board_t)((line >> (4 * i)) & 0xf)
+                         << lineShift(n % 4, 0, i);
+            }
+        }
+        unpackBoard(board, cells);
+        for (x = 0; x < SIZE; x++) {
+            for (y = 0; y < SIZE; y++) {
+                if (cells[x][y] == 15) {
+                    cells[x][y] = 16 + SIZE * x + y;
+                }
+            }
+        }
+        block->inputs[block->count] = board;
+        block->expected_empty[block->count] = countEmpty(cells);
+        block->expected_ended[block->count] = gameEnded(cells);
+        block->expected_scores[block->count] = 0;
+        block->expected_moved[block->count] = referenceMove(
+            &cells[0][0], SIZE, block->directions[block->count],
+            &block->expected_scores[block->count]);
+        for (x = 0; x < SIZE; x++) {
+            for (y = 0; y < SIZE; y++) {
+                cells[x][y] = cells[x][y] < 16 ? cells[x][y] : 15;
+            }
+        }
+        block->expected[block->count] = packBoard(cells);
+        block->count++;
+    }
+    return block->count > 0;
+}
+
+bool reportFuzzCase(struct fuzz_block *block, uint32_t i,
+                    const char *engine) {
+    if (block->boards[i] == block->expected[i] &&
+        block->scores[i] == block->expected_scores[i] &&
+        block->moved[i] == block->expected_moved[i]) {
+        return true;
+    }
+    printf("%s %s: %016llx => %016llx (%u points) expected %016llx "
+           "(%u points)\n",
+           engine, (char *[]){"up", "down", "left", "right"}[block->directions[i]],
+           (unsigned long long)block->inputs[i],
+           (unsigned long long)block->boards[i], block->scores[i],
+           (unsigned long long)block->expected[i], block->expected_scores[i]);
+    return false;
+}
+
+bool testEngines() {
+    static struct fuzz_block block;
+    bool (*moves[])(board_t *, uint8_t, uint32_t *) = {arrayMove,
+                                                       bitboardMove};
+    char *names[] = {"array", "bitboard"};
+    const struct batch_kernels *kernels;
+    rng_t rng = 4;
+    uint32_t first, i, e, k;
+
+    for (first = 0; nextFuzzBlock(&block, first, &rng); first += FUZZ_BLOCK) {
+        for (e = 0; e < sizeof(moves) / sizeof(moves[0]); e++) {
+            for (i = 0; i < block.count; i++) {
+                block.boards[i] = block.inputs[i];
+                block.scores[i] = 0;
+                block.moved[i] = moves[e](&block.boards[i],
+                                          block.directions[i],
+                                          &block.scores[i]);
+                if (!reportFuzzCase(&block, i, names[e])) {
+                    return false;
+                }
+            }
+        }
+        for (k = 0; k < batch_kernel_count; k++) {
+            kernels = &all_batch_kernels[k];
+            if (!kernels->supported()) {
+                continue;
+            }
+            memcpy(block.boards, block.inputs, block.count * sizeof(board_t));
+            memset(block.scores, 0, sizeof(block.scores));
+            kernels->move(block.boards, block.scores, block.directions,
+                          block.moved, block.count);
+            kernels->count_empty(block.inputs, block.empty, block.count);
+            kernels->game_ended(block.inputs, block.ended, block.count);
+            for (i = 0; i < block.count; i++) {
+                if (!reportFuzzCase(&block, i, kernels->name)) {
+                    return false;
+                }
+                if (block.empty[i] != block.expected_empty[i] ||
+                    block.ended[i] != block.expected_ended[i]) {
+                    printf("%s: %016llx has %u empty cells (ended %u) "
+                           "expected %u (ended %u)\n",
+                           kernels->name, (unsigned long long)block.inputs[i],
+                           block.empty[i], block.ended[i],
+                           block.expected_empty[i], block.expected_ended[i]);
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// the kernels of every board size against the reference, on boards with
+// many empty cells and on full ones, which every so often cannot move
+#define TEST_SIZED_BOARDS 4096
+
+bool testSizedKernels() {
+    const struct sized_kernels *kernels;
+    uint8_t cells[MAX_SIZE * MAX_SIZE], moved_cells[MAX_SIZE * MAX_SIZE];
+    uint8_t expected[MAX_SIZE * MAX_SIZE];
+    uint8_t k, n, d, c, empty;
+    uint32_t i, score, expected_score;
+    bool moved, expected_moved, movable;
+    rng_t rng = 5;
+
+    for (k = 0; k < sizeof(all_sized_kernels) / sizeof(all_sized_kernels[0]);
+         k++) {
+        kernels = &all_sized_kernels[k];
+        n = kernels->size;
+        for (i = 0; i < TEST_SIZED_BOARDS; i++) {
+            empty = 0;
+            for (c = 0; c < n * n; c++) {
+                cells[c] = i % 4 == 0            ? 1 + rngBelow(&rng, 20)
+                           : rngBelow(&rng, 2) ? 0
+                                               : 1 + rngBelow(&rng, 3);
+                empty += cells[c] == 0;
+            }
+            movable = false;
+            for (d = UP; d <= RIGHT; d++) {
+                memcpy(expected, cells, n * n);
+                expected_score = 0;
+                expected_moved = referenceMove(expected, n, d, &expected_score);
+                memcpy(moved_cells, cells, n * n);
+                score = 0;
+                moved = kernels->move(moved_cells, d, &score);
+                if (moved != expected_moved || score != expected_score ||
+                    memcmp(moved_cells, expected, n * n) != 0) {
+                    printf("moveSized%u: board %u (direction %u) => %u points "
+                           "expected %u points\n",
+                           n, i, d, score, expected_score);
+                    return false;
+                }
+                movable |= moved;
+            }
+            if (kernels->count_empty(cells) != empty ||
+                // an empty board is the only one that can neither move
+                // nor is over
+                kernels->game_ended(cells) != (!movable && empty < n * n)) {
+                printf("sized %ux%u: board %u has %u empty cells (ended %u) "
+                       "expected %u (ended %u)\n",
+                       n, n, i, kernels->count_empty(cells),
+                       kernels->game_ended(cells), empty,
+                       !movable && empty < n * n);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// every board kernel this cpu has must count, pick and pack like the scalar
+// one, which is the last
+bool testBoardKernels() {
+    const struct board_kernels *kernels,
+        *scalar = &all_board_kernels[board_kernel_count - 1];
+    uint8_t cells[SIZE][SIZE], expected[SIZE][SIZE];
+    uint8_t k, n, count;
+    uint32_t i;
+    uint64_t bits, cell;
+    board_t board;
+    rng_t rng = 6;
+
+    for (k = 0; k < board_kernel_count; k++) {
+        kernels = &all_board_kernels[k];
+        if (!kernels->supported()) {
+            continue;
+        }
+        for (i = 0; i < TEST_SIZED_BOARDS; i++) {
+            board = rngNext(&rng);
+            bits = rngNext(&rng) & 0x1111111111111111ULL;
+            count = kernels->pop_count(bits);
+            if (count != scalar->pop_count(bits) ||
+                kernels->pop_count(board) != scalar->pop_count(board)) {
+                printf("%s: %016llx has %u bits set expected %u\n",
+                       kernels->name, (unsigned long long)bits, count,
+                       scalar->pop_count(bits));
+                return false;
+            }
+            for (n = 0; n < count; n++) {
+                cell = kernels->select_cell(bits, n);
+                if (cell != scalar->select_cell(bits, n)) {
+                    printf("%s: cell %u of %016llx is %016llx expected "
+                           "%016llx\n",
+                           kernels->name, n, (unsigned long long)bits,
+                           (unsigned long long)cell,
+                           (unsigned long long)scalar->select_cell(bits, n));
+                    return false;
+                }
+            }
+            kernels->unpack(board, cells);
+            scalar->unpack(board, expected);
+            if (memcmp(cells, expected, sizeof(cells)) != 0) {
+                printf("%s: %016llx unpacks differently\n", kernels->name,
+                       (unsigned long long)board);
+                return false;
+            }
+            if (kernels->pack(cells) != board) {
+                printf("%s: %016llx packs to %016llx\n", kernels->name,
+                       (unsigned long long)board,
+                       (unsigned long long)kernels->pack(cells));
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+#define TEST_GAMES 64
+
+// plays random games and checks that the masks follow the board and that the
+// tiles spawn like they do in the array code
+bool testGameState() {
+    uint8_t cells[SIZE][SIZE];
+    struct game game;
+    rng_t reference, moves = 0;
+    uint32_t g;
+
+    for (g = 0; g < TEST_GAMES; g++) {
+        game.rng = reference = g;
+        gameInit(&game);
+        initBoard(cells, &reference);
+        while (true) {
+            if (packBoard(cells) != game.board ||
+                game.empty != emptyCells(game.board) ||
+                game.merges != mergeCells(game.board) ||
+                gameIsOver(&game) != gameEnded(cells)) {
+                printf("game %u: %016llx (empty %016llx, merges %016llx) "
+                       "expected %016llx\n",
+                       g, (unsigned long long)game.board,
+                       (unsigned long long)game.empty,
+                       (unsigned long long)game.merges,
+                       (unsigned long long)packBoard(cells));
+                return false;
+            }
+            if (gameIsOver(&game)) {
+                break;
+            }
+            while (!gameMove(&game, rngBelow(&moves, 4))) {
+            }
+            unpackBoard(game.board, cells);
+            gameAddRandom(&game);
+            addRandom(cells, &reference);
+        }
+    }
+    return true;
+}
+
+// steps a vector of games with random actions and plays the same games one
+// by one next to it, the reset ones included
+#define TEST_ENV_STEPS 4096
+
+bool testEnv() {
+    struct env_batch *env = newEnvBatch(TEST_GAMES);
+    struct game games[TEST_GAMES];
+    uint64_t seeds[TEST_GAMES];
+    uint8_t actions[TEST_GAMES], dones[TEST_GAMES];
+    uint32_t rewards[TEST_GAMES], score, g, s;
+    rng_t moves = 3;
+    bool success = env != NULL;
+
+    for (g = 0; g < TEST_GAMES; g++) {
+        games[g].rng = seeds[g] = 1000 + g;
+        gameInit(&games[g]);
+    }
+    if (success) {
+        envReset(env, seeds);
+    }
+    for (s = 0; success && s < TEST_ENV_STEPS; s++) {
+        for (g = 0; g < TEST_GAMES; g++) {
+            actions[g] = rngBelow(&moves, 4);
+        }
+        envStep(env, actions, rewards, dones);
+        for (g = 0; g < TEST_GAMES && success; g++) {
+            score = games[g].score;
+            if (gameMove(&games[g], actions[g])) {
+                gameAddRandom(&games[g]);
+            }
+            score = games[g].score - score;
+            if (dones[g] != gameIsOver(&games[g])) {
+                printf("envStep: game %u ended %u at step %u expected %u\n",
+                       g, dones[g], s, gameIsOver(&games[g]));
+                success = false;
+            }
+            if (gameIsOver(&games[g])) {
+                gameInit(&games[g]);
+            }
+            if (env->boards[g] != games[g].board || rewards[g] != score ||
+                env->scores[g] != games[g].score) {
+                printf("envStep: game %u at step %u => %016llx (%u points) "
+                       "expected %016llx (%u points)\n",
+                       g, s, (unsigned long long)env->boards[g], rewards[g],
+                       (unsigned long long)games[g].board, score);
+                success = false;
+            }
+        }
+    }
+    if (env != NULL) {
+        freeEnvBatch(env);
+    }
+    return success;
+}
+
+// sends pipelined requests through a pipe, split in the middle of a line, and
+// compares the replies with the same games played here
+#define TEST_SERVE_REQUESTS 8192
+#define TEST_SERVE_MOVES 30000
+
+// plays the moves of a request the way the server does, other letters are
+// skipped
+void playRequest(struct game *game, const char *moves, uint32_t count) {
+    uint32_t i;
+    for (i = 0; i < count && !gameIsOver(game); i++) {
+        if (strchr("udlr", moves[i]) != NULL &&
+            gameMove(game, strchr("udlr", moves[i]) - "udlr")) {
+            gameAddRandom(game);
+        }
+    }
+}
+
+uint32_t printReply(char *reply, size_t size, const struct game *game) {
+    return snprintf(reply, size, "1 %016llx %u %u\n",
+                    (unsigned long long)game->board, game->score,
+                    gameIsOver(game));
+}
+
+// long requests that fill the input buffer to the last byte, with the last
+// one cut off until the next read, are all answered: they are mostly letters
+// that are no move, so that the game is not over before the cut
+bool testServeLongLines() {
+    static char requests[SERVE_INPUT + 4];
+    struct connection *connection;
+    struct game game = {0, 0, 7, 0, 0};
+    char replies[256], expected[256];
+    int in[2], out[2];
+    uint32_t i, first, last, length;
+    ssize_t read_length = 0;
+    bool success;
+
+    if (pipe(in) != 0 || pipe(out) != 0) {
+        return false;
+    }
+    length = snprintf(requests, sizeof(requests), "n 1 7\nm 1 ");
+    first = length;
+    for (i = 0; i < TEST_SERVE_MOVES; i++) {
+        requests[length++] = i < 16 ? "udlr"[i % 4] : 'x';
+    }
+    length += snprintf(requests + length, sizeof(requests) - length, "\nm 1 ");
+    last = length;
+    for (i = length; i < SERVE_INPUT; i++) {
+        requests[i] = 'x';
+    }
+    // the tail of the last request comes with the next read
+    memcpy(requests + SERVE_INPUT, "rrrr", 4);
+    connection = newConnection(in[0], out[1]);
+    success = connection != NULL &&
+              write(in[1], requests, SERVE_INPUT) == SERVE_INPUT &&
+              serveInput(connection) &&
+              write(in[1], "rrrr\ns 1\n", 10) == 10 &&
+              serveInput(connection);
+    if (success) {
+        read_length = read(out[0], replies, sizeof(replies) - 1);
+    }
+    replies[read_length > 0 ? read_length : 0] = '\0';
+    gameInit(&game);
+    length = printReply(expected, sizeof(expected), &game);
+    playRequest(&game, requests + first, TEST_SERVE_MOVES);
+    length += printReply(expected + length, sizeof(expected) - length, &game);
+    playRequest(&game, requests + last, SERVE_INPUT + 4 - last);
+    length += printReply(expected + length, sizeof(expected) - length, &game);
+    printReply(expected + length, sizeof(expected) - length, &game);
+    if (success && strcmp(replies, expected) != 0) {
+        printf("long requests => %s expected %s", replies, expected);
+        success = false;
+    }
+    if (connection != NULL) {
+        freeConnection(connection);
+    }
+    close(in[0]);
+    close(in[1]);
+    close(out[0]);
+    close(out[1]);
+    return success;
+}
+
+// a client that reads its replies slowly keeps them waiting in the connection
+// instead of blocking the server, and gets every one of them in the end
+bool testServeBackpressure(struct connection *connection, int requests[2],
+                           int answers[2]) {
+    char buffer[4096];
+    uint32_t i, replies = 0, rounds;
+    ssize_t length;
+    for (i = 0; i < TEST_SERVE_REQUESTS; i++) {
+        memcpy(buffer + 4 * (i % 1024), "s 7\n", 4);
+        if (i % 1024 == 1023 && write(requests[1], buffer, 4096) != 4096) {
+            return false;
+        }
+    }
+    if (fcntl(answers[0], F_SETFL, O_NONBLOCK) != 0 ||
+        fcntl(answers[1], F_SETFL, O_NONBLOCK) != 0 ||
+        !serveInput(connection) || connection->output_length == 0) {
+        printf("serveInput did not keep the replies that wait\n");
+        return false;
+    }
+    for (rounds = 0; replies < TEST_SERVE_REQUESTS && rounds < 1000;
+         rounds++) {
+        while ((length = read(answers[0], buffer, sizeof(buffer))) > 0) {
+            for (i = 0; i < length; i++) {
+                replies += buffer[i] == '\n';
+            }
+        }
+        if (!serveRequests(connection)) {
+            return false;
+        }
+    }
+    if (replies != TEST_SERVE_REQUESTS) {
+        printf("serveRequests answered %u requests expected %u\n", replies,
+               TEST_SERVE_REQUESTS);
+        return false;
+    }
+    return true;
+}
+
+bool testServe() {
+    struct connection *connection;
+    struct game game = {0, 0, 9, 0, 0};
+    char replies[256], expected[256];
+    int requests[2], answers[2];
+    ssize_t length;
+    bool success;
+
+    if (pipe(requests) != 0 || pipe(answers) != 0) {
+        return false;
+    }
+    connection = newConnection(requests[0], answers[1]);
+    success = connection != NULL &&
+              write(requests[1], "n 7 9\nm 7 ll", 12) == 12 &&
+              serveInput(connection) &&
+              write(requests[1], "dr\ns 8\nx\n", 9) == 9 &&
+              serveInput(connection);
+    length = success ? read(answers[0], replies, sizeof(replies) - 1) : 0;
+    replies[length > 0 ? length : 0] = '\0';
+    gameInit(&game);
+    length = snprintf(expected, sizeof(expected), "7 %016llx 0 0\n",
+                      (unsigned long long)game.board);
+    if (gameMove(&game, LEFT)) {
+        gameAddRandom(&game);
+    }
+    if (gameMove(&game, LEFT)) {
+        gameAddRandom(&game);
+    }
+    if (gameMove(&game, DOWN)) {
+        gameAddRandom(&game);
+    }
+    if (gameMove(&game, RIGHT)) {
+        gameAddRandom(&game);
+    }
+    snprintf(expected + length, sizeof(expected) - length,
+             "7 %016llx %u %u\nerror game 8 not started\n"
+             "error unknown request\n",
+             (unsigned long long)game.board, game.score, gameIsOver(&game));
+    if (strcmp(replies, expected) != 0) {
+        printf("serveInput => %s expected %s", replies, expected);
+        success = false;
+    }
+    if (success && !testServeBackpressure(connection, requests, answers)) {
+        success = false;
+    }
+    if (success && !testServeLongLines()) {
+        success = false;
+    }
+    if (connection != NULL) {
+        freeConnection(connection);
+    }
+    close(requests[0]);
+    close(requests[1]);
+    close(answers[0]);
+    close(answers[1]);
+    return success;
+}
+
+// games written to an archive read back the same, from any move on
+bool testArchive() {
+    struct archive_writer writer;
+    struct recording recording = {0, 0, NULL, NULL, 0, false};
+    struct archive archive;
+    struct archive_game record;
+    struct game game = {0, 0, 13, 0, 0}, seeked;
+    uint64_t seeds[20];
+    uint32_t scores[20], i, j;
+    uint8_t direction, *data = NULL;
+    rng_t moves = 14;
+    FILE *file = tmpfile();
+    long size;
+    bool success = file != NULL;
+
+    if (success) {
+        openArchiveWriter(&writer, file, 16);
+    }
+    for (i = 0; i < 20 && success; i++) {
+        seeds[i] = game.rng;
+        startRecording(&recording, game.rng);
+        gameInit(&game);
+        while (!gameIsOver(&game)) {
+            direction = rngBelow(&moves, 4);
+            if (gameMove(&game, direction)) {
+                gameAddRandom(&game);
+                recordMove(&recording, direction, &game, 16);
+            }
+        }
+        scores[i] = game.score;
+        writeRecording(&writer, &recording, game.score);
+    }
+    free(recording.directions);
+    free(recording.checkpoints);
+    if (success) {
+        success = closeArchiveWriter(&writer) && (size = ftell(file)) > 0 &&
+                  (data = malloc(size)) != NULL &&
+                  fseek(file, 0, SEEK_SET) == 0 &&
+                  fread(data, size, 1, file) == 1;
+        fclose(file);
+    }
+    success = success && !readArchive(&archive, data, size - 1) &&
+              readArchive(&archive, data, size) && archive.games == 20 &&
+              !archiveGame(&archive, 20, &record);
+    for (i = 0; i < 20 && success; i++) {
+        success = archiveGame(&archive, i, &record) &&
+                  record.seed == seeds[i] && record.score == scores[i];
+        game.rng = seeds[i];
+        gameInit(&game);
+        for (j = 0; j <= record.moves && success; j++) {
+            archiveSeek(&record, j, &seeked);
+            if (seeked.board != game.board || seeked.score != game.score ||
+                seeked.rng != game.rng || seeked.empty != game.empty) {
+                printf("archiveSeek(%u, %u) did not match the replay\n", i, j);
+                success = false;
+            }
+            if (j < record.moves) {
+                gameMove(&game, archiveMove(&record, j));
+                gameAddRandom(&game);
+            }
+        }
+        success = success && game.score == scores[i] && gameIsOver(&game);
+    }
+    // a corrupt count of moves that would wrap the size of the record, with
+    // no checkpoints to make up for it
+    if (success) {
+        memset(data + 12, 0, 4);
+        memset(data + ARCHIVE_HEADER + 8, 0xff, 4);
+        data[ARCHIVE_HEADER + 8] = 0xe1;
+        success = readArchive(&archive, data, size) &&
+                  !archiveGame(&archive, 0, &record);
+    }
+    free(data);
+    return success;
+}
+
+// the ranking of the seeds does not depend on how the threads split them
+bool testExplore() {
+    struct player_settings settings = {"greedy", 0, 0, 0, 1, NULL};
+    struct explorer explorers[2];
+    uint8_t i;
+    uint32_t j;
+    for (i = 0; i < 2; i++) {
+        memset(&explorers[i], 0, sizeof(struct explorer));
+        explorers[i].seeds = 1000;
+        explorers[i].horizon = 40;
+        explorers[i].threads = i == 0 ? 1 : 7;
+        explorers[i].settings = &settings;
+        if (!runExplorer(&explorers[i]) || explorers[i].explored != 1000 ||
+            explorers[i].best_count != TOP_SEEDS ||
+            explorers[i].worst_count != TOP_SEEDS) {
+            printf("runExplorer on %u threads explored %llu seeds\n",
+                   explorers[i].threads,
+                   (unsigned long long)explorers[i].explored);
+            return false;
+        }
+    }
+    for (j = 0; j < TOP_SEEDS; j++) {
+        if (explorers[0].best[j].seed != explorers[1].best[j].seed ||
+            explorers[0].worst[j].seed != explorers[1].worst[j].seed ||
+            (j > 0 && betterSeed(&explorers[0].best[j],
+                                 &explorers[0].best[j - 1])) ||
+            betterSeed(&explorers[0].best[TOP_SEEDS - 1],
+                       &explorers[0].worst[j]) == false) {
+            printf("the ranked seeds differ at %u\n", j);
+            return false;
+        }
+    }
+    return true;
+}
+
+// a move picked from the outcomes is the move of the engine
+bool testOutcomes() {
+    struct game game = {0, 0, 10, 0, 0}, predicted;
+    rng_t moves = 11;
+    uint32_t i;
+    uint8_t direction;
+    bool moved;
+    gameInit(&game);
+    for (i = 0; i < 1 << 14; i++) {
+        if (gameIsOver(&game)) {
+            gameInit(&game);
+        }
+        direction = rngBelow(&moves, 4);
+        predicted = game;
+        // half of the moves find the outcomes of their board already there
+        if (i % 2 == 0) {
+            predictMoves(&outcomes, game.board, game.score);
+        }
+        moved = movePredicted(&predicted, direction);
+        if (moved != gameMove(&game, direction) ||
+            predicted.board != game.board || predicted.score != game.score ||
+            predicted.rng != game.rng || predicted.empty != game.empty ||
+            predicted.merges != game.merges) {
+            printf("movePredicted(%016llx, %u) did not match gameMove\n",
+                   (unsigned long long)outcomes.board, direction);
+            return false;
+        }
+        if (moved) {
+            gameAddRandom(&game);
+        }
+    }
+    return true;
+}
+
+// the canonical board is the smallest of the 8 symmetries of the array
+// board, and the table keeps the deepest results of a bucket
+bool testTable() {
+    static const uint32_t depths[] = {3, 5, 4, 1, 2, 6}; // A to F
+    static const bool kept[] = {true, true, true, false, false, true};
+    uint8_t board[SIZE][SIZE], mirror[SIZE][SIZE], flipped[SIZE][SIZE];
+    struct tt_bucket *tt = newTable();
+    board_t packed, symmetry, least, boards[6];
+    rng_t rng = 8;
+    uint32_t i, found = 0;
+    uint8_t r, x, y;
+    float value;
+    bool success = tt != NULL;
+
+    for (i = 0; i < 1000 && success; i++) {
+        packed = rngNext(&rng);
+        unpackBoard(packed, board);
+        least = packed;
+        for (r = 0; r < 4; r++) {
+            rotateBoard(board);
+            for (x = 0; x < SIZE; x++) {
+                for (y = 0; y < SIZE; y++) {
+                    mirror[x][y] = board[SIZE - 1 - x][y];
+                    flipped[x][y] = board[x][SIZE - 1 - y];
+                }
+            }
+            symmetry = packBoard(board);
+            least = symmetry < least ? symmetry : least;
+            least = packBoard(mirror) < least ? packBoard(mirror) : least;
+            if (canonicalBoard(symmetry) != canonicalBoard(packed) ||
+                mirrorColumns(symmetry) != packBoard(mirror) ||
+                mirrorRows(symmetry) != packBoard(flipped) ||
+                fabsf(evaluateBoard(symmetry) - evaluateBoard(packed)) >
+                    1e-5f * fabsf(evaluateBoard(packed))) {
+                printf("symmetry %016llx of %016llx\n",
+                       (unsigned long long)symmetry,
+                       (unsigned long long)packed);
+                success = false;
+            }
+        }
+        if (canonicalBoard(packed) != least) {
+            printf("canonicalBoard(%016llx) => %016llx, expected %016llx\n",
+                   (unsigned long long)packed,
+                   (unsigned long long)canonicalBoard(packed),
+                   (unsigned long long)least);
+            success = false;
+        }
+    }
+
+    // six boards that fall in the same bucket
+    boards[found++] = rngNext(&rng);
+    while (success && found < 6) {
+        packed = rngNext(&rng);
+        if (findBucket(tt, packed) == findBucket(tt, boards[0])) {
+            boards[found++] = packed;
+        }
+    }
+    for (i = 0; i < 6 && success; i++) {
+        storeTable(tt, boards[i], depths[i], i);
+    }
+    for (i = 0; i < 6 && success; i++) {
+        if (probeTable(tt, boards[i], depths[i], &value) != kept[i] ||
+            (kept[i] && value != i) ||
+            probeTable(tt, boards[i], depths[i] + 1, &value)) {
+            printf("probeTable(%u) after the stores did not match\n", i);
+            success = false;
+        }
+    }
+    // an entry that was torn by another thread matches no board
+    if (success) {
+        findBucket(tt, boards[1])->entries[1].data ^= 1ULL << 32;
+        if (probeTable(tt, boards[1], 1, &value)) {
+            printf("probeTable found a torn entry\n");
+            success = false;
+        }
+    }
+    free(tt);
+    return success;
+}
+
+// the merged statistics of two halves match those of all the values, and the
+// sketch keeps every quantile within 1% of the sorted values
+bool testBatchStats() {
+    static struct batch_stats halves[2], all;
+    static double values[1 << 14];
+    const double quantiles[] = {0, 0.01, 0.25, 0.5, 0.9, 0.99, 1};
+    double mean = 0, m2 = 0, exact, estimate;
+    rng_t rng = 7;
+    uint32_t i, n = sizeof(values) / sizeof(values[0]);
+
+    initBatchStats(&halves[0]);
+    initBatchStats(&halves[1]);
+    initBatchStats(&all);
+    for (i = 0; i < n; i++) {
+        // spread over many orders of magnitude, with some zeros
+        values[i] = rngBelow(&rng, 1000) * pow(10, rngBelow(&rng, 6));
+        addGame(&halves[i % 3 == 0], values[i], i, 0, i % TILE_VALUES);
+        addGame(&all, values[i], i, 0, i % TILE_VALUES);
+        mean += values[i];
+    }
+    mean /= n;
+    for (i = 0; i < n; i++) {
+        m2 += (values[i] - mean) * (values[i] - mean);
+    }
+    mergeBatchStats(&halves[0], &halves[1]);
+    if (halves[0].games != n || halves[0].moves != all.moves ||
+        memcmp(halves[0].max_tiles, all.max_tiles, sizeof(all.max_tiles)) ||
+        memcmp(halves[0].score.buckets, all.score.buckets,
+               sizeof(all.score.buckets)) ||
+        halves[0].score.zeros != all.score.zeros ||
+        fabs(halves[0].score.mean - mean) > 1e-9 * mean ||
+        fabs(all.score.mean - mean) > 1e-9 * mean ||
+        fabs(halves[0].score.m2 - m2) > 1e-9 * m2 ||
+        fabs(all.score.m2 - m2) > 1e-9 * m2) {
+        printf("merged mean %f, m2 %f, expected %f, %f\n",
+               halves[0].score.mean, halves[0].score.m2, mean, m2);
+        return false;
+    }
+    qsort(values, n, sizeof(double), compareDoubles);
+    for (i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); i++) {
+        exact = values[(uint32_t)(quantiles[i] * (n - 1))];
+        estimate = measureQuantile(&halves[0].score, quantiles[i]);
+        if (fabs(estimate - exact) > 0.01 * exact) {
+            printf("quantile %.2f => %f, expected %f\n", quantiles[i],
+                   estimate, exact);
+            return false;
+        }
+    }
+    return true;
+}
+
+// every time falls in a bucket that ends at most a quarter above it
+bool testProfile() {
+    uint64_t ns, end;
+    rng_t rng = 6;
+    uint32_t i;
+    for (i = 0; i < 1 << 16; i++) {
+        ns = rngNext(&rng) >> (i % 64);
+        end = bucketTime(profileBucket(ns));
+        if (end < ns || end - ns > ns / 4 + 1 ||
+            (ns > 0 && profileBucket(ns - 1) > profileBucket(ns))) {
+            printf("profileBucket(%llu) => %u ending at %llu\n",
+                   (unsigned long long)ns, profileBucket(ns),
+                   (unsigned long long)end);
+            return false;
+        }
+    }
+    return true;
+}
+
+// fills a short history past its depth and walks it back and forth
+bool testHistory() {
+    struct history history;
+    struct game game = {0, 0, 0, 0, 0};
+    uint32_t i, undone = 0, redone = 0;
+    bool success;
+
+    if (!initHistory(&history, 3)) {
+        return false;
+    }
+    for (i = 1; i <= 10; i++) {
+        game.board = i;
+        game.score = 10 * i;
+        pushState(&history, &game);
+    }
+    while (undoMove(&history, &game)) {
+        undone++;
+    }
+    success = undone == 3 && game.board == 7 && game.score == 70;
+    while (redoMove(&history, &game)) {
+        redone++;
+    }
+    success = success && redone == 3 && game.board == 10;
+    // a new move after an undo leaves nothing to redo
+    undoMove(&history, &game);
+    game.board = 11;
+    pushState(&history, &game);
+    success = success && !redoMove(&history, &game) &&
+              undoMove(&history, &game) && game.board == 9;
+    if (!success) {
+        printf("history: %u undone, %u redone, at board %llu\n", undone,
+               redone, (unsigned long long)game.board);
+    }
+    freeHistory(&history);
+    return success;
+}
+
+// saves a game with its history, loads it into a shorter history and checks
+// that a changed byte is noticed
+bool testStateFile() {
+    struct history history, loaded;
+    struct game game = {0, 0, 12345, 0, 0}, copy = {0, 0, 0, 0, 0};
+    uint8_t data[STATE_HEADER + 8 * STATE_ENTRY + 8];
+    size_t size;
+    uint32_t i;
+    bool success;
+
+    if (!initHistory(&history, 7)) {
+        return false;
+    }
+    if (!initHistory(&loaded, 2)) {
+        freeHistory(&history);
+        return false;
+    }
+    gameInit(&game);
+    clearHistory(&history, &game);
+    for (i = 0; i < 10; i++) {
+        while (!gameMove(&game, rngBelow(&game.rng, 4))) {
+        }
+        gameAddRandom(&game);
+        pushState(&history, &game);
+    }
+    undoMove(&history, &game);
+    size = encodeState(data, &game, &history);
+    success = size == sizeof(data) &&
+              decodeState(data, size, &copy, &loaded) &&
+              copy.board == game.board && copy.score == game.score &&
+              copy.rng == game.rng && copy.empty == game.empty &&
+              loaded.count == 3 && loaded.current == 1 &&
+              redoMove(&loaded, &copy) && redoMove(&history, &game) &&
+              copy.board == game.board;
+    data[20] ^= 1;
+    success = success && !decodeState(data, size, &copy, &loaded);
+    if (!success) {
+        printf("state file: %016llx (%u points) loaded as %016llx "
+               "(%u points)\n",
+               (unsigned long long)game.board, game.score,
+               (unsigned long long)copy.board, copy.score);
+    }
+    freeHistory(&history);
+    freeHistory(&loaded);
+    return success;
+}
+
+// the index loads back byte for byte, but only for the log it covers
+bool testScoreIndex() {
+    struct score_index index, loaded;
+    uint8_t data[SCORE_INDEX_SIZE], i;
+    memset(&index, 0, sizeof(index));
+    for (i = 0; i < 20; i++) {
+        addToIndex(&index, 1000 * (i % 7) + i);
+    }
+    index.log_size = 0x123456789ULL;
+    encodeScoreIndex(data, &index);
+    if (!decodeScoreIndex(data, index.log_size, &loaded) ||
+        loaded.games != 20 || loaded.total_score != index.total_score ||
+        memcmp(loaded.best, index.best, sizeof(index.best)) != 0 ||
+        loaded.best[0] != 6013 || loaded.best[TOP_SCORES - 1] != 3010 ||
+        decodeScoreIndex(data, index.log_size + 1, &loaded)) {
+        printf("score index: %llu games loaded, best %u\n",
+               (unsigned long long)loaded.games, loaded.best[0]);
+        return false;
+    }
+    return true;
+}
+
+int test() {
+    uint8_t array[SIZE];
+    // these are exponents with base 2 (1=2 2=4 3=8)
+    // data holds per line: 4x IN, 4x OUT, 1x POINTS
+    uint8_t data[] = {
+        0, 0, 0,  1, 1, 0, 0, 0, 0, 0, 0, 1, 1, 2, 0, 0, 0, 4,  0, 1, 0, 1, 2, 0,
+        0, 0, 4,  1, 0, 0, 1, 2, 0, 0, 0, 4, 1, 0, 1, 0, 2, 0,  0, 0, 4, 1, 1, 1,
+        0, 2, 1,  0, 0, 4, 1, 0, 1, 1, 2, 1, 0, 0, 4, 1, 1, 0,  1, 2, 1, 0, 0, 4,
+        1, 1, 1,  1, 2, 2, 0, 0, 8, 2, 2, 1, 1, 3, 2, 0, 0, 12, 1, 1, 2, 2, 2, 3,
+        0, 0, 12, 3, 0, 1, 1, 3, 2, 0, 0, 4, 2, 0, 1, 1, 2, 2,  0, 0, 4};
+    struct {
+        char *name;
+        bool (*run)(void);
+    } suites[] = {{"engines", testEngines},
+                  {"sized kernels", testSizedKernels},
+                  {"board kernels", testBoardKernels},
+                  {"game state", testGameState},
+                  {"env", testEnv},
+                  {"serve", testServe},
+                  {"archive", testArchive},
+                  {"explore", testExplore},
+                  {"outcomes", testOutcomes},
+                  {"table", testTable},
+                  {"batch stats", testBatchStats},
+                  {"profile", testProfile},
+                  {"history", testHistory},
+                  {"state file", testStateFile},
+                  {"score index", testScoreIndex}};
+    uint8_t *in, *out, *points;
+    uint8_t t, tests;
+    uint8_t i, d;
+    bool success = true;
+    uint32_t score;
+    board_t board;
+
+    tests = (sizeof(data) / sizeof(data[0])) / (2 * SIZE + 1);
+    for (t = 0; t < tests; t++) {
+        in = data + t * (2 * SIZE + 1);
+        out = in + SIZE;
+        points = in + 2 * SIZE;
+        for (i = 0; i < SIZE; i++) {
+            array[i] = in[i];
+        }
+        score = 0;
+        slideArray(array, &score);
+        for (i = 0; i < SIZE; i++) {
+            if (array[i] != out[i]) {
+                success = false;
+            }
+        }
+        if (score != *points) {
+            success = false;
+        }
+        // the packed engine must slide every column and row the same way
+        for (d = UP; d <= RIGHT && success; d++) {
+            board = 0;
+            for (i = 0; i < SIZE; i++) {
+                board |= (board_t)in[i] << lineShift(d, 0, i);
+            }
+            score = 0;
+            bitboardMove(&board, d, &score);
+            for (i = 0; i < SIZE; i++) {
+                array[i] = (board >> lineShift(d, 0, i)) & 0xf;
+                if (array[i] != out[i]) {
+                    success = false;
+                }
+            }
+            if (score != *points) {
+                success = false;
+            }
+        }
+        if (success == false) {
+            for (i = 0; i < SIZE; i++) {
+                printf("%d ", in[i]);
+            }
+            printf("=> ");
+            for (i = 0; i < SIZE; i++) {
+                printf("%d ", array[i]);
+            }
+            printf("(%d points) expected ", score);
+            for (i = 0; i < SIZE; i++) {
+                printf("%d ", in[i]);
+            }
+            printf("=> ");
+            for (i = 0; i < SIZE; i++) {
+                printf("%d ", out[i]);
+            }
+            printf("(%d points)\n", *points);
+            break;
+        }
+    }
+    // the spawns must come out the same on every platform
+    rng_t rng = 0;
+    uint64_t random = rngNext(&rng);
+    if (success && random != 0xE220A8397B1DCDAFULL) {
+        printf("rngNext(0) => %016llx expected e220a8397b1dcdaf\n",
+               (unsigned long long)random);
+        success = false;
+    }
+    // every engine this cpu has must move like the reference, on the
+    // FUZZ_CASES boards of the differential test and more
+    for (i = 0; i < sizeof(suites) / sizeof(suites[0]) && success; i++) {
+        if (!suites[i].run()) {
+            printf("%s failed\n", suites[i].name);
+            success = false;
+        }
+    }
+    if (success) {
+        printf("All %u vectors, %u fuzz cases and %u test suites executed "
+               "successfully\n",
+               tests, FUZZ_CASES,
+               (uint32_t)(sizeof(suites) / sizeof(suites[0])));
+    }
+    return !success;
+}
+
+// The benchmarks time every engine on the same boards, taken from random
+// games with a fixed seed. Every benchmark runs once to warm up and then
+// BENCH_REPEATS times, the median and the 99th percentile of its time per
+// operation are reported.
+#define BENCH_BOARDS 4096
+#define BENCH_REPEATS 51
+
+struct bench_data {
+    board_t boards[BENCH_BOARDS];
+    uint8_t cells[BENCH_BOARDS][SIZE][SIZE];
+    uint8_t directions[BENCH_BOARDS];
+    board_t batch[BENCH_BOARDS];
+    uint32_t scores[BENCH_BOARDS];
+    uint8_t flags[BENCH_BOARDS];
+};
+struct bench_data bench_data;
+// the results go here, so that the compiler cannot leave out the work
+volatile uint64_t bench_sink;
+
+struct benchmark {
+    char *name;
+    uint32_t ops; // per repetition
+    uint64_t (*run)(uint32_t ops, uint8_t argument);
+    uint8_t argument;
+};
+
+void initBenchData() {
+    struct game game = {0, 0, 2048, 0, 0};
+    rng_t rng = 1;
+    uint32_t i = 0;
+    gameInit(&game);
+    while (i < BENCH_BOARDS) {
+        if (gameIsOver(&game)) {
+            gameInit(&game);
+        }
+        if (gameMove(&game, rngBelow(&rng, 4))) {
+            gameAddRandom(&game);
+            bench_data.boards[i] = game.board;
+            unpackBoard(game.board, bench_data.cells[i]);
+            bench_data.directions[i] = rngBelow(&rng, 4);
+            i++;
+        }
+    }
+}
+
+uint64_t benchSlideArray(uint32_t ops, uint8_t argument) {
+    uint8_t line[SIZE];
+    uint32_t i, score = 0;
+    (void)argument;
+    for (i = 0; i < ops; i++) {
+        memcpy(line, bench_data.cells[i % BENCH_BOARDS][i / BENCH_BOARDS % SIZE],
+               SIZE);
+        slideArray(line, &score);
+    }
+    return score;
+}
+
+uint64_t benchArrayMove(uint32_t ops, uint8_t direction) {
+    bool (*moves[])(uint8_t[SIZE][SIZE], uint32_t *) = {moveUp, moveDown,
+                                                        moveLeft, moveRight};
+    uint8_t cells[SIZE][SIZE];
+    uint32_t i, score = 0;
+    for (i = 0; i < ops; i++) {
+        memcpy(cells, bench_data.cells[i % BENCH_BOARDS], sizeof(cells));
+        moves[direction](cells, &score);
+    }
+    return score;
+}
+
+uint64_t benchGameEnded(uint32_t ops, uint8_t argument) {
+    uint32_t i, ended = 0;
+    (void)argument;
+    for (i = 0; i < ops; i++) {
+        ended += gameEnded(bench_data.cells[i % BENCH_BOARDS]);
+    }
+    return ended;
+}
+
+uint64_t benchAddRandom(uint32_t ops, uint8_t argument) {
+    uint8_t cells[SIZE][SIZE];
+    rng_t rng = 3;
+    uint32_t i;
+    (void)argument;
+    for (i = 0; i < ops; i++) {
+        memcpy(cells, bench_data.cells[i % BENCH_BOARDS], sizeof(cells));
+        addRandom(cells, &rng);
+    }
+    return rng;
+}
+
+uint64_t benchBitboardMove(uint32_t ops, uint8_t direction) {
+    board_t board;
+    uint32_t i, score = 0;
+    for (i = 0; i < ops; i++) {
+        board = bench_data.boards[i % BENCH_BOARDS];
+        bitboardMove(&board, direction, &score);
+        score += board;
+    }
+    return score;
+}
+
+uint64_t benchGameIsOver(uint32_t ops, uint8_t argument) {
+    struct game game = {0, 0, 0, 0, 0};
+    uint32_t i, ended = 0;
+    (void)argument;
+    for (i = 0; i < ops; i++) {
+        game.board = bench_data.boards[i % BENCH_BOARDS];
+        gameRefresh(&game);
+        ended += gameIsOver(&game);
+    }
+    return ended;
+}
+
+uint64_t benchGameAddRandom(uint32_t ops, uint8_t argument) {
+    struct game game = {0, 0, 3, 0, 0};
+    uint32_t i;
+    uint64_t boards = 0;
+    (void)argument;
+    for (i = 0; i < ops; i++) {
+        game.board = bench_data.boards[i % BENCH_BOARDS];
+        gameRefresh(&game);
+        gameAddRandom(&game);
+        boards += game.board;
+    }
+    return boards;
+}
+
+// an operation is picking one of the empty cells of a board
+uint64_t benchSelectCell(uint32_t ops, uint8_t kernel) {
+    const struct board_kernels *kernels = &all_board_kernels[kernel];
+    uint64_t cells, picked = 0;
+    uint32_t i;
+    for (i = 0; i < ops; i++) {
+        cells = emptyCells(bench_data.boards[i % BENCH_BOARDS]) | 1;
+        picked += kernels->select_cell(cells, i % kernels->pop_count(cells));
+    }
+    return picked;
+}
+
+// an operation is unpacking a board and packing it again
+uint64_t benchPackBoard(uint32_t ops, uint8_t kernel) {
+    const struct board_kernels *kernels = &all_board_kernels[kernel];
+    uint8_t cells[SIZE][SIZE];
+    uint64_t boards = 0;
+    uint32_t i;
+    for (i = 0; i < ops; i++) {
+        kernels->unpack(bench_data.boards[i % BENCH_BOARDS], cells);
+        boards += kernels->pack(cells);
+    }
+    return boards;
+}
+
+// an operation is one board of a batch in its direction
+uint64_t benchMoveBatch(uint32_t ops, uint8_t kernel) {
+    uint32_t i, count;
+    uint64_t moved = 0;
+    for (i = 0; i < ops; i += count) {
+        count = ops - i < BENCH_BOARDS ? ops - i : BENCH_BOARDS;
+        memcpy(bench_data.batch, bench_data.boards, count * sizeof(board_t));
+        all_batch_kernels[kernel].move(bench_data.batch, bench_data.scores,
+                                       bench_data.directions,
+                                       bench_data.flags, count);
+        moved += bench_data.flags[count - 1];
+    }
+    return moved;
+}
+
+uint64_t benchDrawBoard(uint32_t ops, uint8_t argument) {
+    uint32_t i;
+    (void)argument;
+    for (i = 0; i < ops; i++) {
+        drawBoard(bench_data.boards[i % BENCH_BOARDS], 0, i);
+    }
+    return ops;
+}
+
+// a vector of games that steps on from one repetition to the next, every
+// game turning its direction a quarter every step
+uint64_t benchEnvStep(uint32_t ops, uint8_t argument) {
+    static struct env_batch *env = NULL;
+    static uint8_t actions[4][BENCH_BOARDS];
+    static uint32_t steps = 0;
+    uint64_t seeds[BENCH_BOARDS], done = 0;
+    uint32_t i;
+    uint8_t d;
+    (void)argument;
+    if (env == NULL) {
+        env = newEnvBatch(BENCH_BOARDS);
+        if (env == NULL) {
+            return 0;
+        }
+        for (i = 0; i < BENCH_BOARDS; i++) {
+            seeds[i] = i;
+            for (d = 0; d < 4; d++) {
+                actions[d][i] = (bench_data.directions[i] + d) % 4;
+            }
+        }
+        envReset(env, seeds);
+    }
+    for (i = 0; i < ops; i += BENCH_BOARDS) {
+        envStep(env, actions[steps++ % 4], bench_data.scores,
+                bench_data.flags);
+        done += bench_data.flags[0];
+    }
+    return done;
+}
+
+uint64_t benchRandomGames(uint32_t ops, uint8_t argument) {
+    struct game game = {0, 0, 5, 0, 0};
+    rng_t moves = 7;
+    uint32_t i;
+    uint64_t total = 0;
+    (void)argument;
+    for (i = 0; i < ops; i++) {
+        gameInit(&game);
+        while (!gameIsOver(&game)) {
+            if (gameMove(&game, rngBelow(&moves, 4))) {
+                gameAddRandom(&game);
+            }
+        }
+        total += game.score;
+    }
+    return total;
+}
+
+// one move of the expectimax player, playing on through the runs on a table
+// that is kept between them
+uint64_t benchSolveMove(uint32_t ops, uint8_t depth) {
+    static struct solver solver = {NULL, false, 0, 0, 0, 0, false, NULL, 0};
+    static struct game game = {0, 0, 9, 0, 0};
+    uint32_t i;
+    uint64_t total = 0;
+    if (solver.tt == NULL) {
+        if (!initSolver(&solver, depth, 0, NULL)) {
+            return 0;
+        }
+        gameInit(&game);
+    }
+    for (i = 0; i < ops; i++) {
+        if (gameIsOver(&game)) {
+            gameInit(&game);
+        }
+        gameMove(&game, solveMove(&solver, game.board, NULL));
+        gameAddRandom(&game);
+        total += game.score;
+    }
+    return total;
+}
+
+// reports the median and the 99th percentile of the time per operation
+void runBenchmark(struct benchmark *benchmark, char *name, bool json,
+                  bool first) {
+    double times[BENCH_REPEATS], start, median, p99;
+    int null_fd = open("/dev/null", O_WRONLY), saved_fd = dup(STDOUT_FILENO);
+    uint32_t i;
+    // what a benchmark writes goes to the null device
+    fflush(stdout);
+    dup2(null_fd, STDOUT_FILENO);
+    bench_sink += benchmark->run(benchmark->ops, benchmark->argument);
+    for (i = 0; i < BENCH_REPEATS; i++) {
+        start = getSeconds();
+        bench_sink += benchmark->run(benchmark->ops, benchmark->argument);
+        times[i] = (getSeconds() - start) * 1e9 / benchmark->ops;
+    }
+    fflush(stdout);
+    dup2(saved_fd, STDOUT_FILENO);
+    close(saved_fd);
+    close(null_fd);
+    qsort(times, BENCH_REPEATS, sizeof(double), compareDoubles);
+    median = times[BENCH_REPEATS / 2];
+    p99 = times[(BENCH_REPEATS * 99 + 99) / 100 - 1];
+    if (json) {
+        printf("%s\n  {\"name\": \"%s\", \"ops\": %u, \"median_ns\": %.2f, "
+               "\"p99_ns\": %.2f, \"ops_per_s\": %.0f}",
+               first ? "[" : ",", name, benchmark->ops, median, p99,
+               1e9 / median);
+    } else {
+        printf("%s,%u,%.2f,%.2f,%.0f\n", name, benchmark->ops, median, p99,
+               1e9 / median);
+    }
+}
+
+int bench(char *format) {
+    struct benchmark benchmarks[] = {
+        {"slideArray", 1 << 16, benchSlideArray, 0},
+        {"moveUp", 1 << 14, benchArrayMove, UP},
+        {"moveDown", 1 << 14, benchArrayMove, DOWN},
+        {"moveLeft", 1 << 14, benchArrayMove, LEFT},
+        {"moveRight", 1 << 14, benchArrayMove, RIGHT},
+        {"gameEnded", 1 << 14, benchGameEnded, 0},
+        {"addRandom", 1 << 14, benchAddRandom, 0},
+        {"bitboardMove up", 1 << 16, benchBitboardMove, UP},
+        {"bitboardMove down", 1 << 16, benchBitboardMove, DOWN},
+        {"bitboardMove left", 1 << 16, benchBitboardMove, LEFT},
+        {"bitboardMove right", 1 << 16, benchBitboardMove, RIGHT},
+        {"gameIsOver", 1 << 16, benchGameIsOver, 0},
+        {"gameAddRandom", 1 << 16, benchGameAddRandom, 0},
+        {"envStep", 1 << 16, benchEnvStep, 0},
+        {"drawBoard", 1 << 10, benchDrawBoard, 0},
+        {"random game", 1 << 4, benchRandomGames, 0},
+        {"solveMove", 1 << 6, benchSolveMove, 3}};
+    struct benchmark kernels[] = {{"selectCell", 1 << 16, benchSelectCell, 0},
+                                  {"packBoard", 1 << 16, benchPackBoard, 0}};
+    struct benchmark batch = {NULL, 1 << 16, benchMoveBatch, 0};
+    bool json = strcmp(format, "json") == 0, first = true;
+    char name[32];
+    uint8_t i, k;
+
+    if (!json && strcmp(format, "csv") != 0) {
+        printf("Error! Unknown benchmark format %s.\n", format);
+        return EXIT_FAILURE;
+    }
+    initBenchData();
+    if (!json) {
+        printf("name,ops,median_ns,p99_ns,ops_per_s\n");
+    }
+    for (i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++) {
+        runBenchmark(&benchmarks[i], benchmarks[i].name, json, first);
+        first = false;
+    }
+    for (i = 0; i < board_kernel_count; i++) {
+        if (!all_board_kernels[i].supported()) {
+            continue;
+        }
+        for (k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+            snprintf(name, sizeof(name), "%s %s", kernels[k].name,
+                     all_board_kernels[i].name);
+            kernels[k].argument = i;
+            runBenchmark(&kernels[k], name, json, false);
+        }
+    }
+    for (i = 0; i < batch_kernel_count; i++) {
+        if (all_batch_kernels[i].supported()) {
+            snprintf(name, sizeof(name), "moveBatch %s",
+                     all_batch_kernels[i].name);
+            batch.argument = i;
+            runBenchmark(&batch, name, json, false);
+        }
+    }
+    if (json) {
+        printf("\n]\n");
+    }
+    return EXIT_SUCCESS;
+}
+
+void signal_callback_handler(int signum) {
+    printf("         TERMINATED         \n");
+    setBufferedInput(true);
+    // make cursor visible, reset all modes
+    printf("\033[?25h\033[m");
+    exit(signum);
+}
+
+uint8_t getScheme(char *color_scheme) {
+    if (strcmp(color_scheme, "blackwhite") == 0) {
+        return 1;
+    }
+    if (strcmp(color_scheme, "bluered") == 0) {
+        return 2;
+    }
+    return 0;
+}
+
+// With --hints a thread searches the board while the player thinks and shows
+// the best move it found so far below the board, one search depth after the
+// other. The main thread never waits for it: posting a board or cancelling the
+// search on a key is only an atomic add to the generation, which the search
+// checks as it goes, and a hint is one word that the thread writes for the
+// generation it searched and then announces on a pipe.
+#define HINT_DEPTH 10
+
+struct hints {
+    pthread_t thread;
+    struct solver solver; // its table stays warm from one move to the next
+    sem_t work;
+    int wake[2]; // written by the thread when a hint is ready
+    board_t board; // the board of the generation, 0 to stop the thread
+    uint32_t generation; // counts the boards and cancels
+    uint64_t hint; // generation << 40 | depth << 32 | direction
+    board_t shown; // the board that the hint line is about, on the main thread
+};
+
+void *runHints(void *arg) {
+    struct hints *hints = arg;
+    struct solver *solver = &hints->solver;
+    uint32_t generation, searched = 0;
+    board_t board;
+    uint8_t depth, direction;
+    float value;
+
+    while (true) {
+        sem_wait(&hints->work);
+        generation = __atomic_load_n(&hints->generation, __ATOMIC_ACQUIRE);
+        board = __atomic_load_n(&hints->board, __ATOMIC_RELAXED);
+        if (board == 0) {
+            return NULL;
+        }
+        // the board may belong to a later generation, that posts again
+        if (generation == searched) {
+            continue;
+        }
+        searched = generation;
+        solver->root = generation;
+        solver->timeout = false;
+        // every depth is searched once, and its move shown as soon as it is
+        // known
+        for (depth = 1; depth <= HINT_DEPTH; depth++) {
+            direction = searchDepth(solver, board, depth, &value);
+            if (solver->timeout) {
+                break;
+            }
+            __atomic_store_n(&hints->hint,
+                             (uint64_t)generation << 40 |
+                                 (uint64_t)depth << 32 | direction,
+                             __ATOMIC_RELEASE);
+            if (write(hints->wake[1], "", 1) < 0) {
+                // the pipe is full, the main thread has a hint to read
+            }
+        }
+    }
+}
+
+// starts the thread, that shares the table of the player when it has one
+bool startHints(struct hints *hints, struct player *player) {
+    memset(hints, 0, sizeof(struct hints));
+    if (!initSolver(&hints->solver, HINT_DEPTH, 0, player->solver.tt)) {
+        return false;
+    }
+    hints->solver.cancel = &hints->generation;
+    if (pipe(hints->wake) != 0) {
+        freeSolver(&hints->solver);
+        return false;
+    }
+    fcntl(hints->wake[0], F_SETFL, O_NONBLOCK);
+    fcntl(hints->wake[1], F_SETFL, O_NONBLOCK);
+    sem_init(&hints->work, 0, 0);
+    if (pthread_create(&hints->thread, NULL, runHints, hints) != 0) {
+        close(hints->wake[0]);
+        close(hints->wake[1]);
+        sem_destroy(&hints->work);
+        freeSolver(&hints->solver);
+        return false;
+    }
+    return true;
+}
+
+// the search of the former board stops, and the hint of it no longer shows
+void cancelHints(struct hints *hints) {
+    __atomic_fetch_add(&hints->generation, 1, __ATOMIC_RELEASE);
+}
+
+void postHints(struct hints *hints, board_t board) {
+    __atomic_store_n(&hints->board, board, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hints->generation, 1, __ATOMIC_RELEASE);
+    sem_post(&hints->work);
+}
+
+void stopHints(struct hints *hints) {
+    postHints(hints, 0);
+    pthread_join(hints->thread, NULL);
+    close(hints->wake[0]);
+    close(hints->wake[1]);
+    sem_destroy(&hints->work);
+    freeSolver(&hints->solver);
+}
+
+// the line below the footer, empty when there is no hint for the board yet
+void drawHint(struct hints *hints) {
+    static const char *arrows[] = {"↑", "↓", "←", "→"};
+    uint64_t hint = __atomic_load_n(&hints->hint, __ATOMIC_ACQUIRE);
+    uint32_t generation = __atomic_load_n(&hints->generation,
+                                          __ATOMIC_RELAXED);
+    char text[96], line[48] = "";
+    if (hint >> 40 == (generation & 0xffffff) && (uint8_t)(hint >> 32) > 0) {
+        snprintf(line, sizeof(line), "     hint: %s (depth %u)",
+                 arrows[hint & 3], (uint8_t)(hint >> 32));
+    }
+    // the cursor goes back to the footer, where the messages are printed
+    snprintf(text, sizeof(text), "\033[%d;1H%s\033[K\033[%d;1H",
+             5 + 3 * SIZE, line, 4 + 3 * SIZE);
+    appendFrame(text);
+    writeFrame();
+}
+
+// spawns the tile of the last move and shows it, returns false when the game
+// is over and the player does not undo the move
+bool finishMove(struct game *game, struct history *history,
+                struct journal *journal, uint8_t scheme,
+                struct player *player) {
+    int c;
+    bool over;
+    uint64_t start = profileClock();
+    gameAddRandom(game);
+    profilePhase(&main_profile, PHASE_SPAWN, start);
+    pushState(history, game);
+    drawBoard(game->board, scheme, game->score);
+    if (player != NULL && player->rollouts > 0) {
+        printf("%15.0f rollouts/s  \n",
+               player->rollouts / player->rollout_seconds);
+    }
+    start = profileClock();
+    over = gameIsOver(game);
+    profilePhase(&main_profile, PHASE_OVER, start);
+    if (!over) {
+        return true;
+    }
+    printf("    GAME OVER, UNDO? (y/N)  \n");
+    while (true) {
+        c = readKey(-1);
+        if (c == 'y') {
+            undoMove(history, game);
+            journalEvent(journal, JOURNAL_UNDO, game);
+            drawBoard(game->board, scheme, game->score);
+            return true;
+        } else if ((c == 'n') || (c == '\n') || (c == KEY_ERROR)) {
+            return false;
+        }
+    }
+}
+
+int play(struct options *options) {
+    bool state_loaded = false;
+    struct player player;
+
+    struct game game = {0, 0, time(NULL), 0, 0};
+    struct history history;
+    struct journal journal;
+    char *journal_file;
+    struct score_store scores;
+    uint8_t scheme;
+    int c, direction;
+    bool success;
+    // the tile of the last move spawns when the animation is over
+    bool spawn_pending = false, computer_moved = false;
+    double spawn_time = 0;
+    int timeout_ms;
+    uint32_t unsaved_moves = 0;
+    uint64_t start;
+    // the hints are of no use when the player makes every move
+    struct hints hints;
+    bool hinting = options->hints && !options->autoplay;
+    scheme = getScheme(options->color_scheme);
+
+    if (!initPlayer(&player, &options->player, time(NULL))) {
+        return EXIT_FAILURE;
+    }
+    if (hinting && !startHints(&hints, &player)) {
+        printf("Error starting the hint thread!\n");
+        freePlayer(&player);
+        return EXIT_FAILURE;
+    }
+    if (!initHistory(&history, options->history_depth)) {
+        if (hinting) {
+            stopHints(&hints);
+        }
+        freePlayer(&player);
+        return EXIT_FAILURE;
+    }
+    initJournal(&journal);
+    journal_file = concatenate(getGameDir(), "/journal");
+    if (options->journal && !openJournal(&journal, journal_file,
+                                         options->history_depth,
+                                         options->sync_moves)) {
+        printf("Error opening journal for writing!\n");
+        free(journal_file);
+        freeHistory(&history);
+        if (hinting) {
+            stopHints(&hints);
+        }
+        freePlayer(&player);
+        return EXIT_FAILURE;
+    }
+    free(journal_file);
+    openScoreStore(&scores);
+    screen.best = scores.index.best[0];
+    screen.diff = options->diff;
+
+    // make cursor invisible, erase entire screen
+    printf("\033[?25l\033[2J");
+
+    // register signal handler for when ctrl-c is pressed
+    signal(SIGINT, signal_callback_handler);
+
+    if (options->do_load) {
+        state_loaded = loadStateFromFile(&game, &history);
+    }
+    if (!state_loaded) {
+        gameInit(&game);
+        clearHistory(&history, &game);
+    }
+    journalEvent(&journal, JOURNAL_STATE, &game);
+    setBufferedInput(false);
+    drawBoard(game.board, scheme, game.score);
+    if (state_loaded) {
+        printf("       State loaded.      \n");
+    }
+    while (true) {
+        if (spawn_pending) {
+            timeout_ms = (spawn_time - getSeconds()) * 1000;
+            start = profileClock();
+            c = readKey(timeout_ms > 0 ? timeout_ms : 0);
+            profilePhase(&main_profile, PHASE_INPUT, start);
+            if (c >= 0 && options->drop_keys) {
+                continue;
+            }
+            // a key pressed during the animation needs the spawn first
+            spawn_pending = false;
+            if (!finishMove(&game, &history, &journal, scheme,
+                            computer_moved ? &player : NULL)) {
+                break;
+            }
+            if (c == KEY_NONE) {
+                continue;
+            }
+        } else {
+            // the tile of every move has spawned here
+            if (options->checkpoint_moves > 0 &&
+                unsaved_moves >= options->checkpoint_moves) {
+                writeStateToFile(&game, &history);
+                unsaved_moves = 0;
+            }
+            if (hinting && hints.shown != game.board) {
+                hints.shown = game.board;
+                postHints(&hints, game.board);
+                drawHint(&hints);
+            }
+            // with autoplay the player presses space for every move
+            start = profileClock();
+            if (options->autoplay) {
+                c = ' ';
+            } else {
+                c = hinting ? readKeyOrWake(hints.wake[0]) : readKey(-1);
+            }
+            profilePhase(&main_profile, PHASE_INPUT, start);
+            if (hinting) {
+                if (c == KEY_NONE) {
+                    drawHint(&hints);
+                    continue;
+                }
+                cancelHints(&hints);
+                hints.shown = 0;
+            }
+        }
+        if (c == KEY_ERROR) {
+            puts("\nError! Cannot read keyboard input!");
+            break;
+        }
+        switch (c) {
+            case 97:  // 'a' key
+            case 104: // 'h' key
+            case KEY_LEFT:
+                direction = LEFT;
+                break;
+            case 100: // 'd' key
+            case 108: // 'l' key
+            case KEY_RIGHT:
+                direction = RIGHT;
                 break;
             case 119: // 'w' key
             case 107: // 'k' key
-            case 65:  // up arrow
-                backupState(board, backup_board, &score, &backup_score, &seed,
-                            &backup_seed);
-                success = moveUp(board, &score);
+            case KEY_UP:
+                direction = UP;
                 break;
             case 115: // 's' key
             case 106: // 'j' key
-            case 66:  // down arrow
-                backupState(board, backup_board, &score, &backup_score, &seed,
-                            &backup_seed);
-                success = moveDown(board, &score);
+            case KEY_DOWN:
+                direction = DOWN;
+                break;
+            case 32: // space key, let the player pick the move
+                start = profileClock();
+                direction = player.move(&player, game.board);
+                profilePhase(&main_profile, PHASE_THINK, start);
                 break;
             default:
-                success = false;
+                direction = -1;
+        }
+        start = profileClock();
+        success = direction >= 0 && movePredicted(&game, direction);
+        if (direction >= 0) {
+            profilePhase(&main_profile, PHASE_MOVE, start);
         }
         if (success) {
-            drawBoard(board, scheme, score);
-            usleep(150 * 1000); // 150 ms
-            addRandom(board, seed);
-            drawBoard(board, scheme, score);
-            updateSeed(&seed);
-            if (gameEnded(board)) {
-                printf("    GAME OVER, UNDO? (y/N)  \n");
-                bool undo = false;
-                while (true) {
-                    c = getchar();
-                    if (c == 'y') {
-                        undo = true;
-                        break;
-                    } else if ((c == 'n') || (c == '\n')) {
-                        break;
-                    }
-                }
-                if (undo) {
-                    backupState(backup_board, board, &backup_score, &score, &backup_seed,
-                                &seed);
-                    drawBoard(board, scheme, score);
-                } else {
-                    break;
-                }
+            journalMove(&journal, direction);
+            unsaved_moves++;
+            computer_moved = c == ' ';
+            if (options->animation_ms > 0) {
+                drawBoard(game.board, scheme, game.score);
+                spawn_pending = true;
+                spawn_time = getSeconds() + options->animation_ms / 1000.0;
+            } else if (!finishMove(&game, &history, &journal, scheme,
+                                   computer_moved ? &player : NULL)) {
+                break;
             }
         }
-        if (c == 'u') {
+        if (c == 'u' && undoMove(&history, &game)) {
             printf("Result: %b", success);
-            time_t seed_to_use;
-            if (*seed_hacking) {
-                seed_to_use = time(NULL);
-            } else {
-                seed_to_use = backup_seed;
+            journalEvent(&journal, JOURNAL_UNDO, &game);
+            if (options->seed_hacking) {
+                game.rng = time(NULL);
+                journalEvent(&journal, JOURNAL_RESEED, &game);
             }
-            backupState(backup_board, board, &backup_score, &score, &seed_to_use,
-                        &seed);
-            drawBoard(board, scheme, score);
+            drawBoard(game.board, scheme, game.score);
+        }
+        if (c == 'U' && redoMove(&history, &game)) {
+            journalEvent(&journal, JOURNAL_REDO, &game);
+            drawBoard(game.board, scheme, game.score);
         }
         if (c == 'q') {
             printf("        QUIT? (y/N)         \n");
-            c = getchar();
+            c = readKey(-1);
             if (c == 'y') {
                 break;
             }
-            drawBoard(board, scheme, score);
+            drawBoard(game.board, scheme, game.score);
         }
         if (c == 'r') {
             printf("       RESTART? (y/N)       \n");
-            c = getchar();
+            c = readKey(-1);
             if (c == 'y') {
-                writeScore(score);
-                initBoard(board);
-                score = 0;
-                updateSeed(&seed);
-                backupState(board, backup_board, &score, &backup_score, &seed,
-                            &backup_seed);
+                journalEvent(&journal, JOURNAL_CHECK, &game);
+                recordScore(&scores, game.score);
+                screen.best = scores.index.best[0];
+                gameInit(&game);
+                clearHistory(&history, &game);
+                journalEvent(&journal, JOURNAL_RESTART, &game);
             }
-            drawBoard(board, scheme, score);
+            drawBoard(game.board, scheme, game.score);
         }
         if (c == 'x') {
-            writeStateToFile(board, &score, &seed);
+            writeStateToFile(&game, &history);
             printf("       State written.       \n");
             printf("\033[?25h\033[m");
+            journalEvent(&journal, JOURNAL_CHECK, &game);
+            closeJournal(&journal);
+            closeScoreStore(&scores);
+            freeHistory(&history);
+            if (hinting) {
+                stopHints(&hints);
+            }
+            freePlayer(&player);
             return EXIT_SUCCESS;
         }
     }
@@ -593,29 +4939,407 @@ int play(char *color_scheme, bool *do_load, bool *seed_hacking) {
     // make cursor visible, reset all modes
     printf("\033[?25h\033[m");
 
-    writeScore(score);
+    recordScore(&scores, game.score);
+    closeScoreStore(&scores);
+    // a checkpoint of a game that is over must not be loaded again
+    if (options->checkpoint_moves > 0) {
+        removeStateFile();
+    }
+    journalEvent(&journal, JOURNAL_CHECK, &game);
+    closeJournal(&journal);
+    freeHistory(&history);
+    if (hinting) {
+        stopHints(&hints);
+    }
+    freePlayer(&player);
+    return EXIT_SUCCESS;
+}
+
+// The boards of the other sizes are played without undo, saving, the journal
+// and the high scores: all of those store the packed 4x4 board.
+int playSized(struct options *options) {
+    struct player player;
+    struct sized_game game;
+    uint8_t scheme = getScheme(options->color_scheme), n = options->size;
+    int c, direction;
+
+    if (!initPlayer(&player, &options->player, time(NULL))) {
+        return EXIT_FAILURE;
+    }
+    if (player.sized_move == NULL) {
+        printf("The %s player only plays on a 4x4 board!\n",
+               options->player.name);
+        freePlayer(&player);
+        return EXIT_FAILURE;
+    }
+    game.rng = time(NULL);
+    sizedGameInit(&game, n);
+
+    // make cursor invisible, erase entire screen
+    printf("\033[?25l\033[2J");
+    signal(SIGINT, signal_callback_handler);
+    setBufferedInput(false);
+    drawSizedBoard(game.cells, n, scheme, game.score);
+    while (true) {
+        c = options->autoplay ? ' ' : readKey(-1);
+        if (c == KEY_ERROR) {
+            puts("\nError! Cannot read keyboard input!");
+            break;
+        }
+        switch (c) {
+            case 97:  // 'a' key
+            case 104: // 'h' key
+            case KEY_LEFT:
+                direction = LEFT;
+                break;
+            case 100: // 'd' key
+            case 108: // 'l' key
+            case KEY_RIGHT:
+                direction = RIGHT;
+                break;
+            case 119: // 'w' key
+            case 107: // 'k' key
+            case KEY_UP:
+                direction = UP;
+                break;
+            case 115: // 's' key
+            case 106: // 'j' key
+            case KEY_DOWN:
+                direction = DOWN;
+                break;
+            case 32: // space key, let the player pick the move
+                direction = player.sized_move(&player, &game);
+                break;
+            default:
+                direction = -1;
+        }
+        if (direction >= 0 &&
+            game.kernels->move(game.cells, direction, &game.score)) {
+            game.kernels->add_random(game.cells, &game.rng);
+            drawSizedBoard(game.cells, n, scheme, game.score);
+            if (game.kernels->game_ended(game.cells)) {
+                printf("         GAME OVER          \n");
+                break;
+            }
+        }
+        if (c == 'q') {
+            printf("        QUIT? (y/N)         \n");
+            c = readKey(-1);
+            if (c == 'y') {
+                break;
+            }
+            drawSizedBoard(game.cells, n, scheme, game.score);
+        }
+        if (c == 'r') {
+            printf("       RESTART? (y/N)       \n");
+            c = readKey(-1);
+            if (c == 'y') {
+                sizedGameInit(&game, n);
+            }
+            drawSizedBoard(game.cells, n, scheme, game.score);
+        }
+    }
+    setBufferedInput(true);
+
+    // make cursor visible, reset all modes
+    printf("\033[?25h\033[m");
+    freePlayer(&player);
+    return EXIT_SUCCESS;
+}
+
+bool readJournal(FILE *file, void *data, size_t size) {
+    return fread(data, 1, size, file) == size;
+}
+
+// Plays a journal back through the same history the game used, drawn at
+// replay_speed moves per second or without drawing as fast as it goes. Where
+// the game ended up is checked against where the journal says it was.
+int replay(struct options *options) {
+    FILE *file = fopen(options->replay_file, "rb");
+    struct history history = {NULL, 0, 0, 0, 0};
+    struct game game = {0, 0, 0, 0, 0};
+    uint8_t scheme = getScheme(options->color_scheme);
+    uint8_t version, moves[JOURNAL_BLOCK / 4], i;
+    uint32_t depth, score, speed = options->replay_speed;
+    uint32_t games = 0, checks = 0, failures = 0;
+    uint64_t total = 0;
+    board_t board;
+    int tag, c;
+    bool valid = true, started = false, quit = false;
+    double start;
+
+    if (file == NULL) {
+        printf("Error opening journal %s!\n", options->replay_file);
+        return EXIT_FAILURE;
+    }
+    if (speed > 0) {
+        // make cursor invisible, erase entire screen
+        printf("\033[?25l\033[2J");
+        signal(SIGINT, signal_callback_handler);
+        setBufferedInput(false);
+    }
+    start = getSeconds();
+    while (valid && !quit && (tag = fgetc(file)) != EOF) {
+        if (tag < JOURNAL_SESSION) {
+            valid = started && readJournal(file, moves, (tag + 3) / 4);
+            for (i = 0; i < tag && valid && !quit; i++) {
+                // a journal only holds the moves that changed the board
+                valid = gameMove(&game, (moves[i / 4] >> (2 * (i % 4))) & 3);
+                if (!valid) {
+                    break;
+                }
+                gameAddRandom(&game);
+                pushState(&history, &game);
+                total++;
+                if (speed > 0) {
+                    drawBoard(game.board, scheme, game.score);
+                    // q stops the replay, other keys are ignored
+                    c = readKey(1000 / speed);
+                    quit = c == 'q' || c == KEY_ERROR;
+                }
+            }
+            continue;
+        }
+        switch (tag) {
+            case JOURNAL_SESSION:
+                valid = readJournal(file, &version, 1) &&
+                        version == JOURNAL_VERSION &&
+                        readJournal(file, &depth, sizeof(depth));
+                freeHistory(&history);
+                valid = valid && initHistory(&history, depth);
+                started = false;
+                break;
+            case JOURNAL_STATE:
+                valid = history.states != NULL &&
+                        readJournal(file, &game.board, sizeof(game.board)) &&
+                        readJournal(file, &game.score, sizeof(game.score)) &&
+                        readJournal(file, &game.rng, sizeof(game.rng));
+                gameRefresh(&game);
+                clearHistory(&history, &game);
+                started = true;
+                games++;
+                break;
+            case JOURNAL_RESTART:
+                valid = started;
+                gameInit(&game);
+                clearHistory(&history, &game);
+                games++;
+                break;
+            case JOURNAL_UNDO:
+                valid = started && undoMove(&history, &game);
+                break;
+            case JOURNAL_REDO:
+                valid = started && redoMove(&history, &game);
+                break;
+            case JOURNAL_RESEED:
+                valid = started && readJournal(file, &game.rng, sizeof(game.rng));
+                break;
+            case JOURNAL_CHECK:
+                valid = started && readJournal(file, &board, sizeof(board)) &&
+                        readJournal(file, &score, sizeof(score));
+                checks++;
+                if (board != game.board || score != game.score) {
+                    failures++;
+                }
+                break;
+            default:
+                valid = false;
+        }
+        if (speed > 0 && started) {
+            drawBoard(game.board, scheme, game.score);
+        }
+    }
+    if (speed > 0) {
+        setBufferedInput(true);
+        // make cursor visible, reset all modes
+        printf("\033[?25h\033[m");
+    }
+    fclose(file);
+    freeHistory(&history);
+    if (!valid) {
+        printf("Error! Journal %s is damaged after %llu moves.\n",
+               options->replay_file, (unsigned long long)total);
+        return EXIT_FAILURE;
+    }
+    if (speed == 0) {
+        printf("games:    %u\n", games);
+        printf("moves:    %llu\n", (unsigned long long)total);
+        printf("time:     %.3f s\n", getSeconds() - start);
+        printf("moves/s:  %.0f\n", total / (getSeconds() - start));
+    }
+    printf("checks:   %u passed, %u failed\n", checks - failures, failures);
+    return failures > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+int printStats() {
+    struct score_index index;
+    uint8_t i;
+    loadScoreIndex(&index);
+    printf("games:    %llu\n", (unsigned long long)index.games);
+    if (index.games > 0) {
+        printf("mean:     %.1f\n", (double)index.total_score / index.games);
+    }
+    printf("best:    ");
+    for (i = 0; i < TOP_SCORES && index.best[i] > 0; i++) {
+        printf(" %u", index.best[i]);
+    }
+    printf("\n");
     return EXIT_SUCCESS;
 }
 
-void getOpts(int argc, char *argv[], bool *test_mode, bool *do_load,
-             bool *seed_hacking, char *color_scheme) {
+void getOpts(int argc, char *argv[], struct options *options) {
+    // the long options have no short form, they get codes beyond a char
+    static struct option long_options[] = {
+        {"stats", no_argument, NULL, 256},
+        {"pipe", no_argument, NULL, 257},
+        {"listen", required_argument, NULL, 258},
+        {"profile", no_argument, NULL, 259},
+        {"hints", no_argument, NULL, 260},
+        {"explore", required_argument, NULL, 261},
+        {"board", required_argument, NULL, 262},
+        {"horizon", required_argument, NULL, 263},
+        {"target", required_argument, NULL, 264},
+        {"archive", required_argument, NULL, 265},
+        {"checkpoints", required_argument, NULL, 266},
+        {"bind", required_argument, NULL, 267},
+        {NULL, 0, NULL, 0}};
     int opt;
-    while ((opt = getopt(argc, argv, "tcls")) != -1) {
+    while ((opt = getopt_long(argc, argv, "tclsb:p:j:d:T:ak:J:DA:C:H:WF:r:R:SK:B:n:o:P:",
+                              long_options, NULL)) != -1) {
         switch (opt) {
             case 't':
-                *test_mode = true;
+                options->test_mode = true;
                 break;
             case 'c':
-                strcpy(color_scheme, argv[optind]);
+                strcpy(options->color_scheme, argv[optind]);
                 break;
             case 'l':
-                *do_load = true;
+                options->do_load = true;
                 break;
             case 's':
-                *seed_hacking = true;
+                options->seed_hacking = true;
+                break;
+            case 'b':
+                options->batch_games = strtoul(optarg, NULL, 10);
+                break;
+            case 'p':
+                options->player.name = optarg;
+                break;
+            case 'j':
+                options->threads = strtoul(optarg, NULL, 10);
+                break;
+            case 'd':
+                options->player.depth = strtoul(optarg, NULL, 10);
+                break;
+            case 'T':
+                options->player.budget_ms = strtoul(optarg, NULL, 10);
+                break;
+            case 'a':
+                options->autoplay = true;
+                break;
+            case 'k':
+                options->player.rollouts = strtoul(optarg, NULL, 10);
+                break;
+            case 'J':
+                options->player.threads = strtoul(optarg, NULL, 10);
+                break;
+            case 'D':
+                options->diff = true;
+                break;
+            case 'A':
+                options->animation_ms = strtoul(optarg, NULL, 10);
+                break;
+            case 'C':
+                options->drop_keys = strcmp(optarg, "drop") == 0;
+                break;
+            case 'H':
+                options->history_depth = strtoul(optarg, NULL, 10);
+                break;
+            case 'W':
+                options->journal = true;
+                break;
+            case 'F':
+                options->sync_moves = strtoul(optarg, NULL, 10);
+                break;
+            case 'r':
+                options->replay_file = optarg;
+                break;
+            case 'R':
+                options->replay_speed = strtoul(optarg, NULL, 10);
+                break;
+            case 'S':
+                options->record_batch = true;
+                break;
+            case 'K':
+                options->checkpoint_moves = strtoul(optarg, NULL, 10);
+                break;
+            case 'B':
+                options->bench_format = optarg;
+                break;
+            case 'o':
+                options->batch_format = optarg;
+                break;
+            case 'P':
+                options->progress_s = strtoul(optarg, NULL, 10);
+                break;
+            case 'n':
+                options->size = strtoul(optarg, NULL, 10);
+                if (options->size < MIN_SIZE || options->size > MAX_SIZE) {
+                    printf("The board size must be from %d to %d!\n",
+                           MIN_SIZE, MAX_SIZE);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 256:
+                options->stats = true;
+                break;
+            case 257:
+                options->pipe = true;
+                break;
+            case 258:
+                options->listen = optarg;
+                break;
+            case 259:
+                options->profile = true;
+                break;
+            case 260:
+                options->hints = true;
+                break;
+            case 261:
+                options->explore_seeds = strtoul(optarg, NULL, 10);
+                break;
+            case 262:
+                options->board = strtoull(optarg, NULL, 16);
+                break;
+            case 263:
+                options->horizon = strtoul(optarg, NULL, 10);
+                break;
+            case 264:
+                options->target = strtoul(optarg, NULL, 10);
+                break;
+            case 265:
+                options->archive = optarg;
+                break;
+            case 266:
+                options->archive_checkpoints = strtoul(optarg, NULL, 10);
+                break;
+            case 267:
+                options->bind = optarg;
                 break;
             default:
-                printf("Usage: %s [-t] [-l] [-s] [-c <standard|blackwhite|bluered] \n",
+                printf("Usage: %s [-t] [-B <csv|json>] [-l] [-s] [-c <standard|blackwhite|bluered] "
+                       "[-n <size>] [-a] [-D] [-A <ms>] [-C <apply|drop>]\n"
+                       "       [-H <depth>] [-K <moves>] [-W] [-F <moves>] [-r <file>] [-R <moves/s>]\n"
+                       "       "
+                       "[-b <games>] [-j <threads>] [-S] [-o <text|csv|json>] [-P <s>]\n"
+                       "       [-p <random|greedy|expectimax|montecarlo>] "
+                       "[-d <depth>] [-T <ms>] [-k <rollouts>]\n"
+                       "       [-J <threads>] [--stats]"
+                       " [--pipe] [--listen <port|path>] [--bind <address>]\n"
+                       "       [--profile] [--hints] [--explore <seeds>] [--board <hex>]"
+                       " [--horizon <moves>]\n"
+                       "       [--target <score>]"
+                       " [--archive <file>] [--checkpoints <moves>]\n",
                        argv[0]);
                 exit(EXIT_FAILURE);
         }
@@ -623,14 +5347,67 @@ void getOpts(int argc, char *argv[], bool *test_mode, bool *do_load,
 }
 
 int main(int argc, char *argv[]) {
-    bool test_mode = false;
-    bool do_load = false;
-    bool seed_hacking = false;
-    char color_scheme[10] = "standard";
-    getOpts(argc, argv, &test_mode, &do_load, &seed_hacking, color_scheme);
-    if (test_mode) {
+    struct options options = {.color_scheme = "standard",
+                              .player = {NULL, 3, 100, 100, 0},
+                              .animation_ms = 150,
+                              .history_depth = 1000,
+                              .replay_speed = 10,
+                              .batch_format = "text",
+                              .archive_checkpoints = 64,
+                              .bind = "127.0.0.1",
+                              .size = SIZE};
+    getOpts(argc, argv, &options);
+    initEngine();
+    initHeuristic();
+    if (options.profile) {
+        startProfiling();
+    }
+    initTileStrings();
+    if (options.test_mode) {
         exit(test());
+    } else if (options.bench_format != NULL) {
+        exit(bench(options.bench_format));
+    } else if (options.stats) {
+        exit(printStats());
+    } else if (options.pipe) {
+        exit(servePipe());
+    } else if (options.listen != NULL) {
+        exit(serveSocket(options.listen, options.bind));
+    } else if (options.replay_file != NULL) {
+        exit(replay(&options));
+    } else if (options.archive != NULL && options.batch_games == 0) {
+        exit(checkArchive(options.archive));
+    } else if (options.explore_seeds > 0) {
+        if (options.player.name == NULL) {
+            options.player.name = "greedy";
+        }
+        if (options.player.threads == 0) {
+            options.player.threads = 1;
+        }
+        exit(explore(&options));
+    } else if (options.batch_games > 0) {
+        if (options.player.name == NULL) {
+            options.player.name = "random";
+        }
+        // the batch workers already keep all cores busy
+        if (options.player.threads == 0) {
+            options.player.threads = 1;
+        }
+        if (options.size != SIZE && options.record_batch) {
+            printf("The high scores only keep 4x4 games!\n");
+            exit(EXIT_FAILURE);
+        }
+        if (options.size != SIZE && options.archive != NULL) {
+            printf("The archives only keep 4x4 games!\n");
+            exit(EXIT_FAILURE);
+        }
+        exit(batch(&options));
     } else {
-        exit(play(color_scheme, &do_load, &seed_hacking));
+        // the player moves when space is pressed, so it better be good
+        if (options.player.name == NULL) {
+            options.player.name = options.size == SIZE ? "expectimax"
+                                                       : "greedy";
+        }
+        exit(options.size == SIZE ? play(&options) : playSized(&options));
     }
 }
@@ -0,0 +1,1460 @@
+/*
+ ============================================================================
+ Name        : lib2048.c
+ Author      : Maurits van der Schee
+ Description : The engine of the game "2048", without terminal or files
+ ============================================================================
+ */
+
+#define _XOPEN_SOURCE 600 // for: posix_memalign
+#include <fcntl.h>        // defines: open, O_RDONLY
+#include <pthread.h>      // defines: pthread_once
+#include <stdbool.h>      // defines: true, false
+#include <stdint.h>       // defines: uint8_t, uint32_t
+#include <stdlib.h>       // defines: posix_memalign, free
+#include <string.h>       // defines: memset, memcpy, memcmp
+#include <sys/mman.h>     // defines: mmap, munmap
+#include <sys/stat.h>     // defines: fstat
+#include <unistd.h>       // defines: close
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h> // defines: __m128i, __m256i, _mm_shuffle_epi8
+#define SIMD_X86 1
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h> // defines: uint8x16_t, vqtbl1q_u8
+#ifdef __linux__
+#include <sys/auxv.h> // defines: getauxval, AT_HWCAP, HWCAP_ASIMD
+#endif
+#define SIMD_NEON 1
+#endif
+
+#include "lib2048.h"
+
+uint64_t rngNext(rng_t *rng) {
+    uint64_t z = (*rng += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// returns a number from 0 up to (but not including) n
+uint32_t rngBelow(rng_t *rng, uint32_t n) {
+    return ((rngNext(rng) >> 32) * n) >> 32;
+}
+
+static board_t scalarPackBoard(uint8_t board[SIZE][SIZE]) {
+    board_t packed = 0;
+    uint8_t x, y;
+    for (x = 0; x < SIZE; x++) {
+        for (y = 0; y < SIZE; y++) {
+            packed |= (board_t)board[x][y] << (4 * (SIZE * x + y));
+        }
+    }
+    return packed;
+}
+
+static void scalarUnpackBoard(board_t packed, uint8_t board[SIZE][SIZE]) {
+    uint8_t x, y;
+    for (x = 0; x < SIZE; x++) {
+        for (y = 0; y < SIZE; y++) {
+            board[x][y] = (packed >> (4 * (SIZE * x + y))) & 0xf;
+        }
+    }
+}
+
+// a line holds the SIZE cells that one slide moves, starting at the cell the
+// tiles slide towards, with the next cell step bytes further in the board
+static uint8_t findTarget(uint8_t *line, int8_t step, uint8_t x, uint8_t stop) {
+    uint8_t t;
+    // if the position is already on the first, don't evaluate
+    if (x == 0) {
+        return x;
+    }
+    for (t = x - 1;; t--) {
+        if (line[t * step] != 0) {
+            if (line[t * step] != line[x * step]) {
+                // merge is not possible, take next position
+                return t + 1;
+            }
+            return t;
+        } else {
+            // we should not slide further, return this one
+            if (t == stop) {
+                return t;
+            }
+        }
+    }
+    // we did not find a target
+    return x;
+}
+
+// slides the n cells of a line, inlined wherever n is a constant so that
+// every board size gets its own unrolled copy
+static inline bool slideCells(uint8_t *line, int8_t step, uint8_t n,
+                              uint32_t *score) {
+    bool success = false;
+    uint8_t x, t, stop = 0;
+
+    for (x = 0; x < n; x++) {
+        if (line[x * step] != 0) {
+            t = findTarget(line, step, x, stop);
+            // if target is not original position, then move or merge
+            if (t != x) {
+                // if target is zero, this is a move
+                if (line[t * step] == 0) {
+                    line[t * step] = line[x * step];
+                } else if (line[t * step] == line[x * step]) {
+                    // merge (increase power of two)
+                    line[t * step]++;
+                    // increase score
+                    *score += (uint32_t)1 << line[t * step];
+                    // set stop to avoid double merge
+                    stop = t + 1;
+                }
+                line[x * step] = 0;
+                success = true;
+            }
+        }
+    }
+    return success;
+}
+
+static bool slideLine(uint8_t *line, int8_t step, uint32_t *score) {
+    return slideCells(line, step, SIZE, score);
+}
+
+bool slideArray(uint8_t array[SIZE], uint32_t *score) {
+    return slideLine(array, 1, score);
+}
+
+// rotates the n by n cells with cell [x][y] at cells[n * x + y]
+void rotateCells(uint8_t *cells, uint8_t n) {
+    uint8_t i, j;
+    uint8_t tmp;
+    for (i = 0; i < n / 2; i++) {
+        for (j = i; j < n - i - 1; j++) {
+            tmp = cells[n * i + j];
+            cells[n * i + j] = cells[n * j + n - i - 1];
+            cells[n * j + n - i - 1] = cells[n * (n - i - 1) + n - j - 1];
+            cells[n * (n - i - 1) + n - j - 1] = cells[n * (n - j - 1) + i];
+            cells[n * (n - j - 1) + i] = tmp;
+        }
+    }
+}
+
+void rotateBoard(uint8_t board[SIZE][SIZE]) {
+    rotateCells(&board[0][0], SIZE);
+}
+
+// columns are contiguous in memory and rows are SIZE bytes apart, so every
+// direction slides its lines in place without rotating the board
+bool moveUp(uint8_t board[SIZE][SIZE], uint32_t *score) {
+    bool success = false;
+    uint8_t x;
+    for (x = 0; x < SIZE; x++) {
+        success |= slideLine(board[x], 1, score);
+    }
+    return success;
+}
+
+bool moveLeft(uint8_t board[SIZE][SIZE], uint32_t *score) {
+    bool success = false;
+    uint8_t y;
+    for (y = 0; y < SIZE; y++) {
+        success |= slideLine(&board[0][y], SIZE, score);
+    }
+    return success;
+}
+
+bool moveDown(uint8_t board[SIZE][SIZE], uint32_t *score) {
+    bool success = false;
+    uint8_t x;
+    for (x = 0; x < SIZE; x++) {
+        success |= slideLine(&board[x][SIZE - 1], -1, score);
+    }
+    return success;
+}
+
+bool moveRight(uint8_t board[SIZE][SIZE], uint32_t *score) {
+    bool success = false;
+    uint8_t y;
+    for (y = 0; y < SIZE; y++) {
+        success |= slideLine(&board[SIZE - 1][y], -SIZE, score);
+    }
+    return success;
+}
+
+static bool findPairDown(uint8_t board[SIZE][SIZE]) {
+    bool success = false;
+    uint8_t x, y;
+    for (x = 0; x < SIZE; x++) {
+        for (y = 0; y < SIZE - 1; y++) {
+            if (board[x][y] == board[x][y + 1])
+                return true;
+        }
+    }
+    return success;
+}
+
+static bool findPairRight(uint8_t board[SIZE][SIZE]) {
+    uint8_t x, y;
+    for (x = 0; x < SIZE - 1; x++) {
+        for (y = 0; y < SIZE; y++) {
+            if (board[x][y] == board[x + 1][y])
+                return true;
+        }
+    }
+    return false;
+}
+
+uint8_t countEmpty(uint8_t board[SIZE][SIZE]) {
+    uint8_t x, y;
+    uint8_t count = 0;
+    for (x = 0; x < SIZE; x++) {
+        for (y = 0; y < SIZE; y++) {
+            if (board[x][y] == 0) {
+                count++;
+            }
+        }
+    }
+    return count;
+}
+
+bool gameEnded(uint8_t board[SIZE][SIZE]) {
+    if (countEmpty(board) > 0)
+        return false;
+    if (findPairDown(board))
+        return false;
+    if (findPairRight(board))
+        return false;
+    return true;
+}
+
+void addRandom(uint8_t board[SIZE][SIZE], rng_t *rng) {
+    uint8_t x, y;
+    uint8_t r, len = 0;
+    uint8_t n, list[SIZE * SIZE][2];
+
+    for (x = 0; x < SIZE; x++) {
+        for (y = 0; y < SIZE; y++) {
+            if (board[x][y] == 0) {
+                list[len][0] = x;
+                list[len][1] = y;
+                len++;
+            }
+        }
+    }
+
+    if (len > 0) {
+        r = rngBelow(rng, len);
+        x = list[r][0];
+        y = list[r][1];
+        n = rngBelow(rng, 10) / 9 + 1;
+        board[x][y] = n;
+    }
+}
+
+void initBoard(uint8_t board[SIZE][SIZE], rng_t *rng) {
+    uint8_t x, y;
+    for (x = 0; x < SIZE; x++) {
+        for (y = 0; y < SIZE; y++) {
+            board[x][y] = 0;
+        }
+    }
+    addRandom(board, rng);
+    addRandom(board, rng);
+}
+
+// SIZED_KERNELS(n) stamps out the code for one board size, with n a constant
+// in code that is inlined, so that the compiler unrolls the loops for it
+static inline bool moveCells(uint8_t *cells, uint8_t direction, uint8_t n,
+                             uint32_t *score) {
+    // the first cell of the first line, how far the next line starts and
+    // the step between the cells of a line, as in moveUp to moveRight
+    uint8_t i, first = direction == DOWN    ? n - 1
+                       : direction == RIGHT ? n * (n - 1)
+                                            : 0;
+    int8_t next = direction == UP || direction == DOWN ? n : 1;
+    int8_t step = direction == UP     ? 1
+                  : direction == DOWN ? -1
+                  : direction == LEFT ? n
+                                      : -n;
+    bool success = false;
+    for (i = 0; i < n; i++) {
+        success |= slideCells(cells + first + i * next, step, n, score);
+    }
+    return success;
+}
+
+static inline uint8_t countEmptyCells(const uint8_t *cells, uint8_t n) {
+    uint8_t i, count = 0;
+    for (i = 0; i < n * n; i++) {
+        count += cells[i] == 0;
+    }
+    return count;
+}
+
+static inline bool cellsEnded(const uint8_t *cells, uint8_t n) {
+    uint8_t x, y;
+    for (x = 0; x < n; x++) {
+        for (y = 0; y < n; y++) {
+            if (cells[n * x + y] == 0 ||
+                (y + 1 < n && cells[n * x + y] == cells[n * x + y + 1]) ||
+                (x + 1 < n && cells[n * x + y] == cells[n * (x + 1) + y])) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static inline void addRandomCell(uint8_t *cells, uint8_t n, rng_t *rng) {
+    uint8_t i, len = 0, list[MAX_SIZE * MAX_SIZE];
+    for (i = 0; i < n * n; i++) {
+        if (cells[i] == 0) {
+            list[len++] = i;
+        }
+    }
+    if (len > 0) {
+        i = list[rngBelow(rng, len)];
+        cells[i] = rngBelow(rng, 10) / 9 + 1;
+    }
+}
+
+#define SIZED_KERNELS(n)                                                      \
+    static bool moveSized##n(uint8_t *cells, uint8_t direction,               \
+                             uint32_t *score) {                               \
+        return moveCells(cells, direction, n, score);                         \
+    }                                                                         \
+    static uint8_t countEmptySized##n(const uint8_t *cells) {                 \
+        return countEmptyCells(cells, n);                                     \
+    }                                                                         \
+    static bool gameEndedSized##n(const uint8_t *cells) {                     \
+        return cellsEnded(cells, n);                                          \
+    }                                                                         \
+    static void addRandomSized##n(uint8_t *cells, rng_t *rng) {               \
+        addRandomCell(cells, n, rng);                                         \
+    }
+#define SIZED_ENTRY(n)                                                        \
+    {n, moveSized##n, countEmptySized##n, gameEndedSized##n, addRandomSized##n}
+
+SIZED_KERNELS(3)
+SIZED_KERNELS(4)
+SIZED_KERNELS(5)
+SIZED_KERNELS(6)
+SIZED_KERNELS(7)
+SIZED_KERNELS(8)
+
+const struct sized_kernels all_sized_kernels[SIZED_KERNEL_COUNT] = {
+    SIZED_ENTRY(3), SIZED_ENTRY(4), SIZED_ENTRY(5),
+    SIZED_ENTRY(6), SIZED_ENTRY(7), SIZED_ENTRY(8)};
+
+void sizedGameInit(struct sized_game *game, uint8_t size) {
+    game->kernels = &all_sized_kernels[size - MIN_SIZE];
+    memset(game->cells, 0, sizeof(game->cells));
+    game->score = 0;
+    game->kernels->add_random(game->cells, &game->rng);
+    game->kernels->add_random(game->cells, &game->rng);
+}
+
+static uint8_t scalarPopCount(uint64_t bits) {
+#ifdef __GNUC__
+    return __builtin_popcountll(bits);
+#else
+    uint8_t count = 0;
+    for (; bits; bits &= bits - 1) {
+        count++;
+    }
+    return count;
+#endif
+}
+
+// returns the lowest bit of every cell that is empty
+uint64_t emptyCells(board_t board) {
+    board |= board >> 2;
+    board |= board >> 1;
+    return ~board & 0x1111111111111111ULL;
+}
+
+// returns the lowest bit of every cell that holds a 32768
+uint64_t fullCells(board_t board) {
+    board &= board >> 2;
+    board &= board >> 1;
+    return board & 0x1111111111111111ULL;
+}
+
+// returns the lowest bit of the n-th (counting from 0) set bit of cells
+static uint64_t scalarSelectCell(uint64_t cells, uint8_t n) {
+    uint8_t shift = 0, width, count;
+    // halve the window until it holds a single cell
+    for (width = 32; width >= 4; width /= 2) {
+        count = scalarPopCount((cells >> shift) & ((1ULL << width) - 1));
+        if (n >= count) {
+            n -= count;
+            shift += width;
+        }
+    }
+    return 1ULL << shift;
+}
+
+#if SIMD_X86
+// Zen 2 and older AMD cpus run pext and pdep in microcode, many times slower
+// than the plain code, so those only get popcnt. The checks themselves are
+// built for any x86-64, only the kernels use the instructions
+static bool bmi2Supported() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("bmi2") &&
+           __builtin_cpu_supports("popcnt") &&
+           !__builtin_cpu_is("amdfam15h") && !__builtin_cpu_is("amdfam17h");
+}
+
+static bool popcntSupported() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("popcnt");
+}
+
+static __attribute__((target("popcnt"))) uint8_t popcntPopCount(uint64_t bits) {
+    return __builtin_popcountll(bits);
+}
+
+static __attribute__((target("popcnt"))) uint64_t
+popcntSelectCell(uint64_t cells, uint8_t n) {
+    uint8_t shift = 0, width, count;
+    for (width = 32; width >= 4; width /= 2) {
+        count = __builtin_popcountll((cells >> shift) & ((1ULL << width) - 1));
+        if (n >= count) {
+            n -= count;
+            shift += width;
+        }
+    }
+    return 1ULL << shift;
+}
+
+// deposits the bit 1 << n on the n-th set bit of cells
+static __attribute__((target("bmi2,popcnt"))) uint64_t
+bmi2SelectCell(uint64_t cells, uint8_t n) {
+    return _pdep_u64(1ULL << n, cells);
+}
+
+// the cells are bytes in the order of the packed board, so the low nibbles
+// of each half of them are gathered at once
+static __attribute__((target("bmi2,popcnt"))) board_t
+bmi2PackBoard(uint8_t board[SIZE][SIZE]) {
+    uint64_t low, high;
+    memcpy(&low, &board[0][0], sizeof(low));
+    memcpy(&high, &board[SIZE / 2][0], sizeof(high));
+    return _pext_u64(low, 0x0F0F0F0F0F0F0F0FULL) |
+           (board_t)_pext_u64(high, 0x0F0F0F0F0F0F0F0FULL) << 32;
+}
+
+static __attribute__((target("bmi2,popcnt"))) void
+bmi2UnpackBoard(board_t packed, uint8_t board[SIZE][SIZE]) {
+    uint64_t low = _pdep_u64(packed, 0x0F0F0F0F0F0F0F0FULL),
+             high = _pdep_u64(packed >> 32, 0x0F0F0F0F0F0F0F0FULL);
+    memcpy(&board[0][0], &low, sizeof(low));
+    memcpy(&board[SIZE / 2][0], &high, sizeof(high));
+}
+#endif
+
+static bool scalarSupported() {
+    return true;
+}
+
+const struct board_kernels all_board_kernels[] = {
+#if SIMD_X86
+    {"bmi2", bmi2Supported, popcntPopCount, bmi2SelectCell, bmi2PackBoard,
+     bmi2UnpackBoard},
+    {"popcnt", popcntSupported, popcntPopCount, popcntSelectCell,
+     scalarPackBoard, scalarUnpackBoard},
+#endif
+    {"scalar", scalarSupported, scalarPopCount, scalarSelectCell,
+     scalarPackBoard, scalarUnpackBoard}};
+const uint8_t board_kernel_count =
+    sizeof(all_board_kernels) / sizeof(all_board_kernels[0]);
+// the portable ones until initEngine picks, so that nothing runs unset
+static struct board_kernels board_kernels = {"scalar", scalarSupported,
+                                             scalarPopCount, scalarSelectCell,
+                                             scalarPackBoard,
+                                             scalarUnpackBoard};
+
+static void initBoardKernels() {
+    uint8_t i = 0;
+    while (!all_board_kernels[i].supported()) {
+        i++;
+    }
+    board_kernels = all_board_kernels[i];
+}
+
+board_t packBoard(uint8_t board[SIZE][SIZE]) {
+    return board_kernels.pack(board);
+}
+
+void unpackBoard(board_t packed, uint8_t board[SIZE][SIZE]) {
+    board_kernels.unpack(packed, board);
+}
+
+uint8_t popCount(uint64_t bits) {
+    return board_kernels.pop_count(bits);
+}
+
+uint64_t selectCell(uint64_t cells, uint8_t n) {
+    return board_kernels.select_cell(cells, n);
+}
+
+// returns the lowest bit of every tile that can merge with the tile below it
+// or to its right, neighbours within a column are 4 bits apart and within a
+// row 16 bits, two 32768 tiles do not merge
+uint64_t mergeCells(board_t board) {
+    return ((emptyCells(board ^ (board >> 4)) & 0x0111011101110111ULL) |
+            (emptyCells(board ^ (board >> 16)) & 0x0000111111111111ULL)) &
+           ~emptyCells(board) & ~fullCells(board);
+}
+
+// bit position of cell j of line i, where a line is a column or a row
+// ordered in the direction the tiles slide to
+uint8_t lineShift(uint8_t direction, uint8_t i, uint8_t j) {
+    switch (direction) {
+        case UP:
+            return 4 * (SIZE * i + j);
+        case DOWN:
+            return 4 * (SIZE * i + SIZE - 1 - j);
+        case LEFT:
+            return 4 * (SIZE * j + i);
+        default:
+            return 4 * (SIZE * (SIZE - 1 - j) + i);
+    }
+}
+
+// every line of 4 cells is one of 65536 values, so the packed engine looks up
+// the slid line (UP towards the low cell, DOWN towards the high cell) and the
+// points for merging it, which are the same in both directions
+static uint16_t slid_lines[2][1 << 16];
+static uint32_t line_scores[1 << 16];
+// the same lines transposed into a column of the board, so that a row move
+// only transposes the board once
+static uint64_t slid_rows[2][1 << 16];
+
+// puts the cells of a line into the matching row of cells in column 0
+static board_t transposeLine(uint16_t line) {
+    board_t row = 0;
+    uint8_t j;
+    for (j = 0; j < SIZE; j++) {
+        row |= (board_t)((line >> 4 * j) & 0xf) << 16 * j;
+    }
+    return row;
+}
+
+static void initTables() {
+    uint32_t line;
+    uint8_t d, j, cells[SIZE];
+    uint16_t slid;
+    for (line = 0; line < (1 << 16); line++) {
+        for (d = UP; d <= DOWN; d++) {
+            for (j = 0; j < SIZE; j++) {
+                // read the line in sliding order
+                cells[j] = (line >> 4 * (d == UP ? j : SIZE - 1 - j)) & 0xf;
+                // give every 32768 its own value, so that they cannot merge
+                if (cells[j] == 15) {
+                    cells[j] = 16 + j;
+                }
+            }
+            line_scores[line] = 0;
+            slideArray(cells, &line_scores[line]);
+            slid = 0;
+            for (j = 0; j < SIZE; j++) {
+                slid |= (cells[j] < 16 ? cells[j] : 15)
+                        << 4 * (d == UP ? j : SIZE - 1 - j);
+            }
+            slid_lines[d][line] = slid;
+            slid_rows[d][line] = transposeLine(slid);
+        }
+    }
+}
+
+// mirrors the board along its diagonal, so that rows become columns
+board_t transpose(board_t board) {
+    board_t a = (board & 0xF0F00F0FF0F00F0FULL) |
+                ((board & 0x0000F0F00000F0F0ULL) << 12) |
+                ((board >> 12) & 0x0000F0F00000F0F0ULL);
+    return (a & 0xFF00FF0000FF00FFULL) |
+           ((a & 0x00FF00FF00000000ULL) >> 24) |
+           ((a << 24) & 0x00FF00FF00000000ULL);
+}
+
+// the columns in reverse order, by swapping the halves and then the columns
+// within them
+board_t mirrorColumns(board_t board) {
+    board = board << 32 | board >> 32;
+    return (board & 0x0000FFFF0000FFFFULL) << 16 |
+           ((board >> 16) & 0x0000FFFF0000FFFFULL);
+}
+
+// every column upside down, the same way on the cells within the columns
+board_t mirrorRows(board_t board) {
+    board = (board & 0x00FF00FF00FF00FFULL) << 8 |
+            ((board >> 8) & 0x00FF00FF00FF00FFULL);
+    return (board & 0x0F0F0F0F0F0F0F0FULL) << 4 |
+           ((board >> 4) & 0x0F0F0F0F0F0F0F0FULL);
+}
+
+// The 8 rotations and reflections of a board play the same, with the moves
+// turned along. The smallest of them stands for all of them.
+board_t canonicalBoard(board_t board) {
+    board_t boards[2] = {board, transpose(board)}, b, best = board;
+    uint8_t i;
+    for (i = 0; i < 2; i++) {
+        b = boards[i];
+        best = b < best ? b : best;
+        b = mirrorColumns(b);
+        best = b < best ? b : best;
+        b = mirrorRows(b);
+        best = b < best ? b : best;
+        b = mirrorColumns(b);
+        best = b < best ? b : best;
+    }
+    return best;
+}
+
+bool bitboardMove(board_t *board, uint8_t direction, uint32_t *score) {
+    board_t rows, result = 0;
+    uint16_t line;
+    uint8_t i;
+    if (direction <= DOWN) {
+        for (i = 0; i < SIZE; i++) {
+            line = *board >> 16 * i;
+            result |= (board_t)slid_lines[direction][line] << 16 * i;
+            *score += line_scores[line];
+        }
+    } else {
+        // row i is column i of the transposed board
+        rows = transpose(*board);
+        for (i = 0; i < SIZE; i++) {
+            line = rows >> 16 * i;
+            result |= slid_rows[direction - LEFT][line] << 4 * i;
+            *score += line_scores[line];
+        }
+    }
+    if (result == *board) {
+        return false;
+    }
+    *board = result;
+    return true;
+}
+
+uint8_t bitboardCountEmpty(board_t board) {
+    return popCount(emptyCells(board));
+}
+
+bool bitboardGameEnded(board_t board) {
+    return !(emptyCells(board) | mergeCells(board));
+}
+
+void bitboardAddRandom(board_t *board, rng_t *rng) {
+    uint64_t empty = emptyCells(*board);
+    uint8_t r, len = popCount(empty);
+    uint8_t n;
+
+    if (len > 0) {
+        // the empty cells are in the same order as the list in addRandom
+        r = rngBelow(rng, len);
+        n = rngBelow(rng, 10) / 9 + 1;
+        *board |= selectCell(empty, r) * n;
+    }
+}
+
+void bitboardInitBoard(board_t *board, rng_t *rng) {
+    *board = 0;
+    bitboardAddRandom(board, rng);
+    bitboardAddRandom(board, rng);
+}
+
+// moves a packed board with the array code, which keeps two 32768 tiles
+// apart like the packed engine does
+bool arrayMove(board_t *board, uint8_t direction, uint32_t *score) {
+    bool (*moves[])(uint8_t[SIZE][SIZE], uint32_t *) = {moveUp, moveDown,
+                                                        moveLeft, moveRight};
+    uint8_t cells[SIZE][SIZE], x, y;
+    bool success;
+    unpackBoard(*board, cells);
+    // give every 32768 its own value, so that they cannot merge
+    for (x = 0; x < SIZE; x++) {
+        for (y = 0; y < SIZE; y++) {
+            if (cells[x][y] == 15) {
+                cells[x][y] = 16 + SIZE * x + y;
+            }
+        }
+    }
+    success = moves[direction](cells, score);
+    for (x = 0; x < SIZE; x++) {
+        for (y = 0; y < SIZE; y++) {
+            if (cells[x][y] >= 16) {
+                cells[x][y] = 15;
+            }
+        }
+    }
+    *board = packBoard(cells);
+    return success;
+}
+
+// the game keeps its board packed at all times, the build switch only picks
+// the code that moves the tiles
+bool engineMove(board_t *board, uint8_t direction, uint32_t *score) {
+#if BITBOARD
+    return bitboardMove(board, direction, score);
+#else
+    return arrayMove(board, direction, score);
+#endif
+}
+
+// recomputes the masks of the game after its board changed wholesale
+void gameRefresh(struct game *game) {
+    game->empty = emptyCells(game->board);
+    game->merges = mergeCells(game->board);
+}
+
+bool gameMove(struct game *game, uint8_t direction) {
+    if (!engineMove(&game->board, direction, &game->score)) {
+        return false;
+    }
+    gameRefresh(game);
+    return true;
+}
+
+void gameAddRandom(struct game *game) {
+    uint64_t cell, equal;
+    uint8_t r, len = popCount(game->empty);
+    uint8_t n;
+
+    if (len > 0) {
+        // the empty cells are in the same order as the list in addRandom
+        r = rngBelow(&game->rng, len);
+        n = rngBelow(&game->rng, 10) / 9 + 1;
+        cell = selectCell(game->empty, r);
+        // only the pairs with the new tile in them can be new merges
+        equal = emptyCells(game->board ^ (0x1111111111111111ULL * n));
+        game->merges |= (((cell >> 4) & equal) | (cell & (equal >> 4))) &
+                        0x0111011101110111ULL;
+        game->merges |= (((cell >> 16) & equal) | (cell & (equal >> 16))) &
+                        0x0000111111111111ULL;
+        game->empty &= ~cell;
+        game->board |= cell * n;
+    }
+}
+
+bool gameIsOver(const struct game *game) {
+    return !(game->empty | game->merges);
+}
+
+void gameInit(struct game *game) {
+    game->board = 0;
+    game->score = 0;
+    gameRefresh(game);
+    gameAddRandom(game);
+    gameAddRandom(game);
+}
+
+// The vector kernels spread a board over 16 bytes, one per cell,
+// and shuffle the bytes so that every direction turns into a slide up. Each
+// column is then compacted with a byte shuffle that is looked up from its
+// cells that hold a tile, neighbours are merged and the column compacted once
+// more. The results match bitboardMove bit for bit.
+static void scalarMoveBatch(board_t *boards, uint32_t *scores,
+                            const uint8_t *directions, uint8_t *moved,
+                            uint32_t count) {
+    uint32_t i;
+    for (i = 0; i < count; i++) {
+        moved[i] = bitboardMove(&boards[i], directions[i], &scores[i]);
+    }
+}
+
+static void scalarCountEmptyBatch(const board_t *boards, uint8_t *counts,
+                                  uint32_t count) {
+    uint32_t i;
+    for (i = 0; i < count; i++) {
+        counts[i] = bitboardCountEmpty(boards[i]);
+    }
+}
+
+static void scalarGameEndedBatch(const board_t *boards, uint8_t *ended,
+                                 uint32_t count) {
+    uint32_t i;
+    for (i = 0; i < count; i++) {
+        ended[i] = bitboardGameEnded(boards[i]);
+    }
+}
+
+#if SIMD_X86 || SIMD_NEON
+#define Z 0x80 // a shuffle index that yields an empty cell
+
+// byte shuffles that turn a direction into a slide up, and back
+static const uint8_t orient_cells[4][16] = {
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12},
+    {0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15},
+    {12, 8, 4, 0, 13, 9, 5, 1, 14, 10, 6, 2, 15, 11, 7, 3}};
+static const uint8_t restore_cells[4][16] = {
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12},
+    {0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15},
+    {3, 7, 11, 15, 2, 6, 10, 14, 1, 5, 9, 13, 0, 4, 8, 12}};
+// for every set of cells holding a tile (bit j for cell j), the cell that
+// moves to position k of the compacted column, in table k
+static const uint8_t compact_cells[4][16] = {
+    {Z, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0},
+    {Z, Z, Z, 1, Z, 2, 2, 1, Z, 3, 3, 1, 3, 2, 2, 1},
+    {Z, Z, Z, Z, Z, Z, Z, 2, Z, Z, Z, 3, Z, 3, 3, 2},
+    {Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, 3}};
+static const uint8_t cell_bits[16] = {1, 2, 4, 8, 1, 2, 4, 8,
+                               1, 2, 4, 8, 1, 2, 4, 8};
+static const uint8_t cell_positions[16] = {0, 1, 2, 3, 0, 1, 2, 3,
+                                    0, 1, 2, 3, 0, 1, 2, 3};
+static const uint8_t column_tops[16] = {3, 3, 3, 3, 7, 7, 7, 7,
+                                 11, 11, 11, 11, 15, 15, 15, 15};
+static const uint8_t column_bases[16] = {0, 0, 0, 0, 4, 4, 4, 4,
+                                  8, 8, 8, 8, 12, 12, 12, 12};
+// the cell after and before every cell within its column
+static const uint8_t next_cells[16] = {1, 2, 3, Z, 5, 6, 7, Z,
+                                9, 10, 11, Z, 13, 14, 15, Z};
+static const uint8_t previous_cells[16] = {Z, 0, 1, 2, Z, 4, 5, 6,
+                                    Z, 8, 9, 10, Z, 12, 13, 14};
+// the points for making a tile, split in a low and a high byte
+static const uint8_t points_low[16] = {0, 2, 4, 8, 16, 32, 64, 128,
+                                0, 0, 0, 0, 0, 0, 0, 0};
+static const uint8_t points_high[16] = {0, 0, 0, 0, 0, 0, 0, 0,
+                                 1, 2, 4, 8, 16, 32, 64, 128};
+// the number of set bits of every nibble
+static const uint8_t nibble_bits[16] = {0, 1, 1, 2, 1, 2, 2, 3,
+                                 1, 2, 2, 3, 2, 3, 3, 4};
+#endif
+
+#if SIMD_X86
+#define LOAD128(table) _mm_loadu_si128((const __m128i *)(table))
+#define LOAD256(table) _mm256_broadcastsi128_si256(LOAD128(table))
+
+static bool sseSupported() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.1");
+}
+
+static __attribute__((target("sse4.1"))) __m128i compactSse(__m128i cells) {
+    __m128i code, shuffle = _mm_setzero_si128();
+    uint8_t k;
+    // the bits of the cells holding a tile add up in the top byte
+    code = _mm_andnot_si128(_mm_cmpeq_epi8(cells, _mm_setzero_si128()),
+                            LOAD128(cell_bits));
+    code = _mm_mullo_epi32(code, _mm_set1_epi32(0x01010101));
+    code = _mm_shuffle_epi8(code, LOAD128(column_tops));
+    for (k = 0; k < SIZE; k++) {
+        shuffle = _mm_or_si128(
+            shuffle,
+            _mm_and_si128(
+                _mm_cmpeq_epi8(LOAD128(cell_positions), _mm_set1_epi8(k)),
+                _mm_shuffle_epi8(LOAD128(compact_cells[k]), code)));
+    }
+    shuffle = _mm_add_epi8(shuffle, LOAD128(column_bases));
+    return _mm_shuffle_epi8(cells, shuffle);
+}
+
+static __attribute__((target("sse4.1"))) __m128i
+slideSse(__m128i cells, uint32_t *score) {
+    __m128i zero = _mm_setzero_si128(), previous = LOAD128(previous_cells);
+    __m128i pairs, first, merged, made, points;
+    cells = compactSse(cells);
+    // a pair merges unless the cell before it already merged with its first
+    pairs = _mm_cmpeq_epi8(cells,
+                           _mm_shuffle_epi8(cells, LOAD128(next_cells)));
+    pairs = _mm_andnot_si128(_mm_cmpeq_epi8(cells, zero), pairs);
+    pairs = _mm_andnot_si128(_mm_cmpeq_epi8(cells, _mm_set1_epi8(15)), pairs);
+    first = _mm_andnot_si128(_mm_shuffle_epi8(pairs, previous), pairs);
+    merged = _mm_andnot_si128(_mm_shuffle_epi8(first, previous), pairs);
+    cells = _mm_sub_epi8(cells, merged);
+    cells = _mm_andnot_si128(_mm_shuffle_epi8(merged, previous), cells);
+    made = _mm_and_si128(cells, merged);
+    points = _mm_add_epi64(
+        _mm_sad_epu8(_mm_shuffle_epi8(LOAD128(points_low), made), zero),
+        _mm_slli_epi64(
+            _mm_sad_epu8(_mm_shuffle_epi8(LOAD128(points_high), made), zero),
+            8));
+    *score += _mm_cvtsi128_si64(points) + _mm_extract_epi64(points, 1);
+    return compactSse(cells);
+}
+
+static __attribute__((target("sse4.1"))) void sseMoveBatch(
+    board_t *boards, uint32_t *scores, const uint8_t *directions,
+    uint8_t *moved, uint32_t count) {
+    __m128i low_nibbles = _mm_set1_epi8(0x0f), cells;
+    board_t result;
+    uint32_t i;
+    for (i = 0; i < count; i++) {
+        cells = _mm_cvtsi64_si128(boards[i]);
+        cells = _mm_unpacklo_epi8(
+            _mm_and_si128(cells, low_nibbles),
+            _mm_and_si128(_mm_srli_epi16(cells, 4), low_nibbles));
+        cells = _mm_shuffle_epi8(cells, LOAD128(orient_cells[directions[i]]));
+        cells = slideSse(cells, &scores[i]);
+        cells = _mm_shuffle_epi8(cells, LOAD128(restore_cells[directions[i]]));
+        // every even cell plus 16 times the odd one after it
+        cells = _mm_maddubs_epi16(cells, _mm_set1_epi16(0x1001));
+        result = _mm_cvtsi128_si64(_mm_packus_epi16(cells, cells));
+        moved[i] = result != boards[i];
+        boards[i] = result;
+    }
+}
+
+static __attribute__((target("sse4.1"))) __m128i emptyCellsSse(__m128i boards) {
+    boards = _mm_or_si128(boards, _mm_srli_epi64(boards, 2));
+    boards = _mm_or_si128(boards, _mm_srli_epi64(boards, 1));
+    return _mm_andnot_si128(boards, _mm_set1_epi64x(0x1111111111111111LL));
+}
+
+static __attribute__((target("sse4.1"))) void sseCountEmptyBatch(
+    const board_t *boards, uint8_t *counts, uint32_t count) {
+    __m128i empty, low_nibbles = _mm_set1_epi8(0x0f);
+    uint32_t i;
+    for (i = 0; i + 2 <= count; i += 2) {
+        empty = emptyCellsSse(LOAD128(&boards[i]));
+        empty = _mm_add_epi8(
+            _mm_shuffle_epi8(LOAD128(nibble_bits),
+                             _mm_and_si128(empty, low_nibbles)),
+            _mm_shuffle_epi8(
+                LOAD128(nibble_bits),
+                _mm_and_si128(_mm_srli_epi16(empty, 4), low_nibbles)));
+        empty = _mm_sad_epu8(empty, _mm_setzero_si128());
+        counts[i] = _mm_extract_epi16(empty, 0);
+        counts[i + 1] = _mm_extract_epi16(empty, 4);
+    }
+    scalarCountEmptyBatch(boards + i, counts + i, count - i);
+}
+
+static __attribute__((target("sse4.1"))) void sseGameEndedBatch(
+    const board_t *boards, uint8_t *ended, uint32_t count) {
+    __m128i pair_rows = _mm_set1_epi64x(0x0111011101110111LL);
+    __m128i pair_columns = _mm_set1_epi64x(0x0000111111111111LL);
+    __m128i board, full, moves;
+    uint32_t i, mask;
+    for (i = 0; i + 2 <= count; i += 2) {
+        board = LOAD128(&boards[i]);
+        full = _mm_and_si128(board, _mm_srli_epi64(board, 2));
+        full = _mm_and_si128(full, _mm_srli_epi64(full, 1));
+        moves = _mm_or_si128(
+            _mm_and_si128(emptyCellsSse(_mm_xor_si128(
+                              board, _mm_srli_epi64(board, 4))),
+                          pair_rows),
+            _mm_and_si128(emptyCellsSse(_mm_xor_si128(
+                              board, _mm_srli_epi64(board, 16))),
+                          pair_columns));
+        moves = _mm_or_si128(_mm_andnot_si128(full, moves),
+                             emptyCellsSse(board));
+        mask = _mm_movemask_pd(
+            _mm_castsi128_pd(_mm_cmpeq_epi64(moves, _mm_setzero_si128())));
+        ended[i] = mask & 1;
+        ended[i + 1] = mask >> 1;
+    }
+    scalarGameEndedBatch(boards + i, ended + i, count - i);
+}
+
+static bool avx2Supported() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+static __attribute__((target("avx2"))) __m256i compactAvx2(__m256i cells) {
+    __m256i code, shuffle = _mm256_setzero_si256();
+    uint8_t k;
+    code = _mm256_andnot_si256(_mm256_cmpeq_epi8(cells, shuffle),
+                               LOAD256(cell_bits));
+    code = _mm256_mullo_epi32(code, _mm256_set1_epi32(0x01010101));
+    code = _mm256_shuffle_epi8(code, LOAD256(column_tops));
+    for (k = 0; k < SIZE; k++) {
+        shuffle = _mm256_or_si256(
+            shuffle,
+            _mm256_and_si256(
+                _mm256_cmpeq_epi8(LOAD256(cell_positions),
+                                  _mm256_set1_epi8(k)),
+                _mm256_shuffle_epi8(LOAD256(compact_cells[k]), code)));
+    }
+    shuffle = _mm256_add_epi8(shuffle, LOAD256(column_bases));
+    return _mm256_shuffle_epi8(cells, shuffle);
+}
+
+// slides two boards, one in each 128-bit lane
+static __attribute__((target("avx2"))) __m256i
+slideAvx2(__m256i cells, uint32_t *scores) {
+    __m256i zero = _mm256_setzero_si256(), previous = LOAD256(previous_cells);
+    __m256i pairs, first, merged, made, points;
+    cells = compactAvx2(cells);
+    pairs = _mm256_cmpeq_epi8(
+        cells, _mm256_shuffle_epi8(cells, LOAD256(next_cells)));
+    pairs = _mm256_andnot_si256(_mm256_cmpeq_epi8(cells, zero), pairs);
+    pairs = _mm256_andnot_si256(
+        _mm256_cmpeq_epi8(cells, _mm256_set1_epi8(15)), pairs);
+    first = _mm256_andnot_si256(_mm256_shuffle_epi8(pairs, previous), pairs);
+    merged = _mm256_andnot_si256(_mm256_shuffle_epi8(first, previous), pairs);
+    cells = _mm256_sub_epi8(cells, merged);
+    cells = _mm256_andnot_si256(_mm256_shuffle_epi8(merged, previous), cells);
+    made = _mm256_and_si256(cells, merged);
+    points = _mm256_add_epi64(
+        _mm256_sad_epu8(_mm256_shuffle_epi8(LOAD256(points_low), made), zero),
+        _mm256_slli_epi64(_mm256_sad_epu8(_mm256_shuffle_epi8(
+                                              LOAD256(points_high), made),
+                                          zero),
+                          8));
+    scores[0] += _mm256_extract_epi64(points, 0) +
+                 _mm256_extract_epi64(points, 1);
+    scores[1] += _mm256_extract_epi64(points, 2) +
+                 _mm256_extract_epi64(points, 3);
+    return compactAvx2(cells);
+}
+
+static __attribute__((target("avx2"))) __m256i
+loadLanes(const uint8_t *low, const uint8_t *high) {
+    return _mm256_inserti128_si256(_mm256_castsi128_si256(LOAD128(low)),
+                                   LOAD128(high), 1);
+}
+
+static __attribute__((target("avx2"))) void avx2MoveBatch(
+    board_t *boards, uint32_t *scores, const uint8_t *directions,
+    uint8_t *moved, uint32_t count) {
+    __m256i low_nibbles = _mm256_set1_epi8(0x0f), cells;
+    board_t result;
+    uint32_t i, j;
+    for (i = 0; i + 2 <= count; i += 2) {
+        cells = _mm256_set_epi64x(0, boards[i + 1], 0, boards[i]);
+        cells = _mm256_unpacklo_epi8(
+            _mm256_and_si256(cells, low_nibbles),
+            _mm256_and_si256(_mm256_srli_epi16(cells, 4), low_nibbles));
+        cells = _mm256_shuffle_epi8(
+            cells, loadLanes(orient_cells[directions[i]],
+                             orient_cells[directions[i + 1]]));
+        cells = slideAvx2(cells, &scores[i]);
+        cells = _mm256_shuffle_epi8(
+            cells, loadLanes(restore_cells[directions[i]],
+                             restore_cells[directions[i + 1]]));
+        cells = _mm256_maddubs_epi16(cells, _mm256_set1_epi16(0x1001));
+        cells = _mm256_packus_epi16(cells, cells);
+        for (j = 0; j < 2; j++) {
+            result = j == 0 ? _mm256_extract_epi64(cells, 0)
+                            : _mm256_extract_epi64(cells, 2);
+            moved[i + j] = result != boards[i + j];
+            boards[i + j] = result;
+        }
+    }
+    sseMoveBatch(boards + i, scores + i, directions + i, moved + i, count - i);
+}
+
+static __attribute__((target("avx2"))) __m256i emptyCellsAvx2(__m256i boards) {
+    boards = _mm256_or_si256(boards, _mm256_srli_epi64(boards, 2));
+    boards = _mm256_or_si256(boards, _mm256_srli_epi64(boards, 1));
+    return _mm256_andnot_si256(boards,
+                               _mm256_set1_epi64x(0x1111111111111111LL));
+}
+
+static __attribute__((target("avx2"))) void avx2CountEmptyBatch(
+    const board_t *boards, uint8_t *counts, uint32_t count) {
+    __m256i empty, low_nibbles = _mm256_set1_epi8(0x0f);
+    uint32_t i;
+    for (i = 0; i + 4 <= count; i += 4) {
+        empty = emptyCellsAvx2(
+            _mm256_loadu_si256((const __m256i *)&boards[i]));
+        empty = _mm256_add_epi8(
+            _mm256_shuffle_epi8(LOAD256(nibble_bits),
+                                _mm256_and_si256(empty, low_nibbles)),
+            _mm256_shuffle_epi8(
+                LOAD256(nibble_bits),
+                _mm256_and_si256(_mm256_srli_epi16(empty, 4), low_nibbles)));
+        empty = _mm256_sad_epu8(empty, _mm256_setzero_si256());
+        counts[i] = _mm256_extract_epi16(empty, 0);
+        counts[i + 1] = _mm256_extract_epi16(empty, 4);
+        counts[i + 2] = _mm256_extract_epi16(empty, 8);
+        counts[i + 3] = _mm256_extract_epi16(empty, 12);
+    }
+    sseCountEmptyBatch(boards + i, counts + i, count - i);
+}
+
+static __attribute__((target("avx2"))) void avx2GameEndedBatch(
+    const board_t *boards, uint8_t *ended, uint32_t count) {
+    __m256i pair_rows = _mm256_set1_epi64x(0x0111011101110111LL);
+    __m256i pair_columns = _mm256_set1_epi64x(0x0000111111111111LL);
+    __m256i board, full, moves;
+    uint32_t i, j, mask;
+    for (i = 0; i + 4 <= count; i += 4) {
+        board = _mm256_loadu_si256((const __m256i *)&boards[i]);
+        full = _mm256_and_si256(board, _mm256_srli_epi64(board, 2));
+        full = _mm256_and_si256(full, _mm256_srli_epi64(full, 1));
+        moves = _mm256_or_si256(
+            _mm256_and_si256(emptyCellsAvx2(_mm256_xor_si256(
+                                 board, _mm256_srli_epi64(board, 4))),
+                             pair_rows),
+            _mm256_and_si256(emptyCellsAvx2(_mm256_xor_si256(
+                                 board, _mm256_srli_epi64(board, 16))),
+                             pair_columns));
+        moves = _mm256_or_si256(_mm256_andnot_si256(full, moves),
+                                emptyCellsAvx2(board));
+        mask = _mm256_movemask_pd(_mm256_castsi256_pd(
+            _mm256_cmpeq_epi64(moves, _mm256_setzero_si256())));
+        for (j = 0; j < 4; j++) {
+            ended[i + j] = (mask >> j) & 1;
+        }
+    }
+    sseGameEndedBatch(boards + i, ended + i, count - i);
+}
+#endif
+
+#if SIMD_NEON
+// NEON comes with every 64-bit ARM cpu, but linux can tell for sure
+static bool neonSupported() {
+#if defined(__linux__) && defined(HWCAP_ASIMD)
+    return getauxval(AT_HWCAP) & HWCAP_ASIMD;
+#else
+    return true;
+#endif
+}
+
+static uint8x16_t compactNeon(uint8x16_t cells) {
+    uint8x16_t code, shuffle = vdupq_n_u8(0);
+    uint8_t k;
+    code = vbicq_u8(vld1q_u8(cell_bits), vceqq_u8(cells, vdupq_n_u8(0)));
+    code = vreinterpretq_u8_u32(vmulq_u32(vreinterpretq_u32_u8(code),
+                                          vdupq_n_u32(0x01010101)));
+    code = vqtbl1q_u8(code, vld1q_u8(column_tops));
+    for (k = 0; k < SIZE; k++) {
+        shuffle = vorrq_u8(
+            shuffle, vandq_u8(vceqq_u8(vld1q_u8(cell_positions),
+                                       vdupq_n_u8(k)),
+                              vqtbl1q_u8(vld1q_u8(compact_cells[k]), code)));
+    }
+    // indices of 16 and up, like Z, yield an empty cell
+    shuffle = vaddq_u8(shuffle, vld1q_u8(column_bases));
+    return vqtbl1q_u8(cells, shuffle);
+}
+
+static uint8x16_t slideNeon(uint8x16_t cells, uint32_t *score) {
+    uint8x16_t previous = vld1q_u8(previous_cells);
+    uint8x16_t pairs, first, merged, made;
+    cells = compactNeon(cells);
+    pairs = vceqq_u8(cells, vqtbl1q_u8(cells, vld1q_u8(next_cells)));
+    pairs = vbicq_u8(pairs, vceqq_u8(cells, vdupq_n_u8(0)));
+    pairs = vbicq_u8(pairs, vceqq_u8(cells, vdupq_n_u8(15)));
+    first = vbicq_u8(pairs, vqtbl1q_u8(pairs, previous));
+    merged = vbicq_u8(pairs, vqtbl1q_u8(first, previous));
+    cells = vsubq_u8(cells, merged);
+    cells = vbicq_u8(cells, vqtbl1q_u8(merged, previous));
+    made = vandq_u8(cells, merged);
+    *score += vaddlvq_u8(vqtbl1q_u8(vld1q_u8(points_low), made)) +
+              ((uint32_t)vaddlvq_u8(vqtbl1q_u8(vld1q_u8(points_high), made))
+               << 8);
+    return compactNeon(cells);
+}
+
+static void neonMoveBatch(board_t *boards, uint32_t *scores,
+                          const uint8_t *directions, uint8_t *moved,
+                          uint32_t count) {
+    uint8x8_t packed;
+    uint8x8x2_t nibbles;
+    uint8x16_t cells;
+    board_t result;
+    uint32_t i;
+    for (i = 0; i < count; i++) {
+        packed = vcreate_u8(boards[i]);
+        nibbles = vzip_u8(vand_u8(packed, vdup_n_u8(0x0f)),
+                          vshr_n_u8(packed, 4));
+        cells = vcombine_u8(nibbles.val[0], nibbles.val[1]);
+        cells = vqtbl1q_u8(cells, vld1q_u8(orient_cells[directions[i]]));
+        cells = slideNeon(cells, &scores[i]);
+        cells = vqtbl1q_u8(cells, vld1q_u8(restore_cells[directions[i]]));
+        packed = vorr_u8(vget_low_u8(vuzp1q_u8(cells, cells)),
+                         vshl_n_u8(vget_low_u8(vuzp2q_u8(cells, cells)), 4));
+        result = vget_lane_u64(vreinterpret_u64_u8(packed), 0);
+        moved[i] = result != boards[i];
+        boards[i] = result;
+    }
+}
+
+static uint64x2_t emptyCellsNeon(uint64x2_t boards) {
+    boards = vorrq_u64(boards, vshrq_n_u64(boards, 2));
+    boards = vorrq_u64(boards, vshrq_n_u64(boards, 1));
+    return vbicq_u64(vdupq_n_u64(0x1111111111111111ULL), boards);
+}
+
+static void neonCountEmptyBatch(const board_t *boards, uint8_t *counts,
+                                uint32_t count) {
+    uint64x2_t empty;
+    uint32_t i;
+    for (i = 0; i + 2 <= count; i += 2) {
+        empty = emptyCellsNeon(vld1q_u64(&boards[i]));
+        empty = vpaddlq_u32(vpaddlq_u16(
+            vpaddlq_u8(vcntq_u8(vreinterpretq_u8_u64(empty)))));
+        counts[i] = vgetq_lane_u64(empty, 0);
+        counts[i + 1] = vgetq_lane_u64(empty, 1);
+    }
+    scalarCountEmptyBatch(boards + i, counts + i, count - i);
+}
+
+static void neonGameEndedBatch(const board_t *boards, uint8_t *ended,
+                               uint32_t count) {
+    uint64x2_t board, full, moves;
+    uint32_t i;
+    for (i = 0; i + 2 <= count; i += 2) {
+        board = vld1q_u64(&boards[i]);
+        full = vandq_u64(board, vshrq_n_u64(board, 2));
+        full = vandq_u64(full, vshrq_n_u64(full, 1));
+        moves = vorrq_u64(
+            vandq_u64(emptyCellsNeon(veorq_u64(board, vshrq_n_u64(board, 4))),
+                      vdupq_n_u64(0x0111011101110111ULL)),
+            vandq_u64(
+                emptyCellsNeon(veorq_u64(board, vshrq_n_u64(board, 16))),
+                vdupq_n_u64(0x0000111111111111ULL)));
+        moves = vorrq_u64(vbicq_u64(moves, full), emptyCellsNeon(board));
+        moves = vceqq_u64(moves, vdupq_n_u64(0));
+        ended[i] = vgetq_lane_u64(moves, 0) & 1;
+        ended[i + 1] = vgetq_lane_u64(moves, 1) & 1;
+    }
+    scalarGameEndedBatch(boards + i, ended + i, count - i);
+}
+#endif
+
+const struct batch_kernels all_batch_kernels[] = {
+#if SIMD_X86
+    {"avx2", avx2Supported, avx2MoveBatch, avx2CountEmptyBatch,
+     avx2GameEndedBatch},
+    {"sse4.1", sseSupported, sseMoveBatch, sseCountEmptyBatch,
+     sseGameEndedBatch},
+#endif
+#if SIMD_NEON
+    {"neon", neonSupported, neonMoveBatch, neonCountEmptyBatch,
+     neonGameEndedBatch},
+#endif
+    {"scalar", scalarSupported, scalarMoveBatch, scalarCountEmptyBatch,
+     scalarGameEndedBatch}};
+const uint8_t batch_kernel_count =
+    sizeof(all_batch_kernels) / sizeof(all_batch_kernels[0]);
+// the portable ones until initEngine picks, like the board kernels
+static struct batch_kernels batch_kernels = {"scalar", scalarSupported,
+                                             scalarMoveBatch,
+                                             scalarCountEmptyBatch,
+                                             scalarGameEndedBatch};
+
+static void initBatchKernels() {
+    uint8_t i = 0;
+    while (!all_batch_kernels[i].supported()) {
+        i++;
+    }
+    batch_kernels = all_batch_kernels[i];
+}
+
+// moves every board in its own direction and adds the points to its score,
+// moved tells which boards changed
+void moveBatch(board_t *boards, uint32_t *scores, const uint8_t *directions,
+               uint8_t *moved, uint32_t count) {
+    batch_kernels.move(boards, scores, directions, moved, count);
+}
+
+void countEmptyBatch(const board_t *boards, uint8_t *counts, uint32_t count) {
+    batch_kernels.count_empty(boards, counts, count);
+}
+
+void gameEndedBatch(const board_t *boards, uint8_t *ended, uint32_t count) {
+    batch_kernels.game_ended(boards, ended, count);
+}
+
+// the arrays of an env batch start on their own cache line
+#define ENV_ALIGN 64
+#define ENV_ALIGNED(size) (((size) + ENV_ALIGN - 1) & ~(size_t)(ENV_ALIGN - 1))
+
+struct env_batch *newEnvBatch(uint32_t count) {
+    size_t header = ENV_ALIGNED(sizeof(struct env_batch));
+    size_t boards = ENV_ALIGNED(count * sizeof(board_t));
+    size_t rngs = ENV_ALIGNED(count * sizeof(rng_t));
+    size_t scores = ENV_ALIGNED(count * sizeof(uint32_t));
+    struct env_batch *batch;
+    uint8_t *memory;
+    if (posix_memalign((void **)&memory, ENV_ALIGN,
+                       header + boards + rngs + scores + count) != 0) {
+        return NULL;
+    }
+    batch = (struct env_batch *)memory;
+    batch->count = count;
+    batch->boards = (board_t *)(memory + header);
+    batch->rngs = (rng_t *)(memory + header + boards);
+    batch->scores = (uint32_t *)(memory + header + boards + rngs);
+    batch->moved = memory + header + boards + rngs + scores;
+    return batch;
+}
+
+void freeEnvBatch(struct env_batch *batch) {
+    free(batch);
+}
+
+void envReset(struct env_batch *batch, const uint64_t *seeds) {
+    uint32_t i;
+    for (i = 0; i < batch->count; i++) {
+        batch->rngs[i] = seeds[i];
+        batch->scores[i] = 0;
+        bitboardInitBoard(&batch->boards[i], &batch->rngs[i]);
+    }
+}
+
+void envStep(struct env_batch *batch, const uint8_t *actions,
+             uint32_t *rewards, uint8_t *dones) {
+    uint32_t i;
+    // the kernels add the points of every move to its reward
+    memset(rewards, 0, batch->count * sizeof(uint32_t));
+    batch_kernels.move(batch->boards, rewards, actions, batch->moved,
+                       batch->count);
+    for (i = 0; i < batch->count; i++) {
+        if (batch->moved[i]) {
+            batch->scores[i] += rewards[i];
+            bitboardAddRandom(&batch->boards[i], &batch->rngs[i]);
+        }
+    }
+    batch_kernels.game_ended(batch->boards, dones, batch->count);
+    for (i = 0; i < batch->count; i++) {
+        if (dones[i]) {
+            batch->scores[i] = 0;
+            bitboardInitBoard(&batch->boards[i], &batch->rngs[i]);
+        }
+    }
+}
+
+static pthread_once_t engine_once = PTHREAD_ONCE_INIT;
+
+static void initEngineOnce() {
+    initTables();
+    initBoardKernels();
+    initBatchKernels();
+}
+
+void initEngine(void) {
+    pthread_once(&engine_once, initEngineOnce);
+}
+
+static uint64_t readLittle(const uint8_t *data, uint8_t size) {
+    uint64_t value = 0;
+    uint8_t i;
+    for (i = 0; i < size; i++) {
+        value |= (uint64_t)data[i] << (8 * i);
+    }
+    return value;
+}
+
+bool readArchive(struct archive *archive, const void *data, size_t size) {
+    const uint8_t *bytes = data, *footer;
+    uint64_t index;
+    memset(archive, 0, sizeof(struct archive));
+    if (size < ARCHIVE_HEADER + ARCHIVE_FOOTER ||
+        memcmp(bytes, ARCHIVE_MAGIC, 8) != 0 ||
+        readLittle(bytes + 8, 4) != ARCHIVE_VERSION) {
+        return false;
+    }
+    footer = bytes + size - ARCHIVE_FOOTER;
+    index = readLittle(footer, 8);
+    archive->games = readLittle(footer + 8, 8);
+    if (memcmp(footer + 16, ARCHIVE_MAGIC, 8) != 0 || index < ARCHIVE_HEADER ||
+        index > size - ARCHIVE_FOOTER ||
+        archive->games != (size - ARCHIVE_FOOTER - index) / 8 ||
+        (size - ARCHIVE_FOOTER - index) % 8 != 0) {
+        return false;
+    }
+    archive->data = bytes;
+    archive->size = size;
+    archive->checkpoint_moves = readLittle(bytes + 12, 4);
+    archive->index = bytes + index;
+    return true;
+}
+
+bool openArchive(struct archive *archive, const char *path) {
+    struct stat status;
+    void *data;
+    int fd = open(path, O_RDONLY);
+    memset(archive, 0, sizeof(struct archive));
+    if (fd < 0) {
+        return false;
+    }
+    if (fstat(fd, &status) != 0 || status.st_size == 0) {
+        close(fd);
+        return false;
+    }
+    data = mmap(NULL, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    // the mapping stays valid without the file descriptor
+    close(fd);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+    if (!readArchive(archive, data, status.st_size)) {
+        munmap(data, status.st_size);
+        return false;
+    }
+    archive->mapped = true;
+    return true;
+}
+
+void closeArchive(struct archive *archive) {
+    if (archive->mapped) {
+        munmap((void *)archive->data, archive->size);
+    }
+    memset(archive, 0, sizeof(struct archive));
+}
+
+size_t archiveRecordSize(uint32_t moves, uint32_t checkpoint_moves) {
+    // in size_t, so that a corrupt count of moves cannot wrap
+    size_t size = ARCHIVE_RECORD + ((size_t)moves + 31) / 32 * 8;
+    if (checkpoint_moves > 0) {
+        size += (size_t)(moves / checkpoint_moves) * ARCHIVE_CHECKPOINT;
+    }
+    return size;
+}
+
+bool archiveGame(const struct archive *archive, uint64_t i,
+                 struct archive_game *game) {
+    const uint8_t *record;
+    uint64_t offset, end = archive->index - archive->data;
+    if (i >= archive->games) {
+        return false;
+    }
+    offset = readLittle(archive->index + 8 * i, 8);
+    if (offset < ARCHIVE_HEADER || offset > end - ARCHIVE_RECORD) {
+        return false;
+    }
+    record = archive->data + offset;
+    game->seed = readLittle(record, 8);
+    game->moves = readLittle(record + 8, 4);
+    game->score = readLittle(record + 12, 4);
+    game->checkpoint_moves = archive->checkpoint_moves;
+    if (archiveRecordSize(game->moves, game->checkpoint_moves) >
+        end - offset) {
+        return false;
+    }
+    game->directions = record + ARCHIVE_RECORD;
+    game->checkpoints =
+        game->directions + ((size_t)game->moves + 31) / 32 * 8;
+    return true;
+}
+
+uint8_t archiveMove(const struct archive_game *game, uint32_t j) {
+    return (game->directions[j / 4] >> (2 * (j % 4))) & 3;
+}
+
+void archiveSeek(const struct archive_game *game, uint32_t j,
+                 struct game *state) {
+    const uint8_t *checkpoint;
+    uint32_t done = 0;
+    if (j > game->moves) {
+        j = game->moves;
+    }
+    if (game->checkpoint_moves > 0 && j >= game->checkpoint_moves) {
+        done = j - j % game->checkpoint_moves;
+        checkpoint = game->checkpoints +
+                     (done / game->checkpoint_moves - 1) * ARCHIVE_CHECKPOINT;
+        state->board = readLittle(checkpoint, 8);
+        state->rng = readLittle(checkpoint + 8, 8);
+        state->score = readLittle(checkpoint + 16, 8);
+        gameRefresh(state);
+    } else {
+        state->rng = game->seed;
+        gameInit(state);
+    }
+    for (; done < j; done++) {
+        gameMove(state, archiveMove(game, done));
+        gameAddRandom(state);
+    }
+}
@@ -0,0 +1,255 @@
+/*
+ ============================================================================
+ Name        : lib2048.h
+ Author      : Maurits van der Schee
+ Description : The engine of the game "2048", without terminal or files
+ ============================================================================
+ */
+
+// Everything a game needs is in the structs it is handed: the board, the
+// score and the state of the random generator. The library does no I/O but
+// for mapping archives, and its only globals are the lookup tables and the
+// board and batch kernels for this cpu, that initEngine sets up once and that
+// are read-only afterwards, so any number of threads can play their own games
+// at the same time.
+
+#ifndef LIB2048_H
+#define LIB2048_H
+
+#include <stdbool.h> // defines: bool
+#include <stddef.h>  // defines: size_t
+#include <stdint.h>  // defines: uint8_t, uint32_t, uint64_t
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SIZE 4
+
+// build with -DBITBOARD=1 (make BITBOARD=1) to play on the packed engine
+#ifndef BITBOARD
+#define BITBOARD 0
+#endif
+
+// The packed engine keeps the whole board in one 64-bit word: every cell
+// holds its exponent in 4 bits, cell board[x][y] at bit 4 * (SIZE * x + y).
+// Column x is thus the 16 bits at 16 * x, with the top cell in the low bits.
+// This limits tiles to 32768, two of them are kept apart instead of merging.
+#if SIZE != 4
+#error "the packed board only fits a 4x4 board"
+#endif
+typedef uint64_t board_t;
+
+enum direction { UP, DOWN, LEFT, RIGHT };
+
+// The tiles spawn from a splitmix64 generator: its whole state is a single
+// 64-bit word that the game carries along, so that the same state gives the
+// same game on every platform and undo simply restores it.
+typedef uint64_t rng_t;
+
+// Next to the board the game keeps the mask of its empty cells and of the
+// cells that can merge with their neighbour below or to the right, so that a
+// spawn and the game over check need no scan of the board.
+struct game {
+    board_t board;
+    uint32_t score;
+    rng_t rng;
+    uint64_t empty;
+    uint64_t merges;
+};
+
+// fills the lookup tables and picks the board and batch kernels, once per
+// process
+void initEngine(void);
+
+uint64_t rngNext(rng_t *rng);
+uint32_t rngBelow(rng_t *rng, uint32_t n);
+
+// a game on the packed board, which gameInit empties and then spawns two
+// tiles on: set its rng first
+void gameInit(struct game *game);
+bool gameMove(struct game *game, uint8_t direction);
+void gameAddRandom(struct game *game);
+bool gameIsOver(const struct game *game);
+void gameRefresh(struct game *game);
+
+// every cell of the array board must be below 16, the most a nibble holds
+board_t packBoard(uint8_t board[SIZE][SIZE]);
+void unpackBoard(board_t packed, uint8_t board[SIZE][SIZE]);
+
+// the array engine, on one byte per cell with cell [x][y] at board[x][y]
+bool slideArray(uint8_t array[SIZE], uint32_t *score);
+void rotateCells(uint8_t *cells, uint8_t n);
+void rotateBoard(uint8_t board[SIZE][SIZE]);
+bool moveUp(uint8_t board[SIZE][SIZE], uint32_t *score);
+bool moveDown(uint8_t board[SIZE][SIZE], uint32_t *score);
+bool moveLeft(uint8_t board[SIZE][SIZE], uint32_t *score);
+bool moveRight(uint8_t board[SIZE][SIZE], uint32_t *score);
+uint8_t countEmpty(uint8_t board[SIZE][SIZE]);
+bool gameEnded(uint8_t board[SIZE][SIZE]);
+void addRandom(uint8_t board[SIZE][SIZE], rng_t *rng);
+void initBoard(uint8_t board[SIZE][SIZE], rng_t *rng);
+
+// the packed engine
+uint8_t popCount(uint64_t bits);
+uint64_t emptyCells(board_t board);
+uint64_t fullCells(board_t board);
+uint64_t selectCell(uint64_t cells, uint8_t n);
+uint64_t mergeCells(board_t board);
+uint8_t lineShift(uint8_t direction, uint8_t i, uint8_t j);
+board_t transpose(board_t board);
+board_t mirrorColumns(board_t board);
+board_t mirrorRows(board_t board);
+board_t canonicalBoard(board_t board);
+bool bitboardMove(board_t *board, uint8_t direction, uint32_t *score);
+uint8_t bitboardCountEmpty(board_t board);
+bool bitboardGameEnded(board_t board);
+void bitboardAddRandom(board_t *board, rng_t *rng);
+void bitboardInitBoard(board_t *board, rng_t *rng);
+
+// The bit tricks under the packed engine, the spawns and the search have a
+// version for every cpu they run faster on: with bmi2 a cell is picked with
+// one pdep and a board packed with two pext, popcnt counts the cells in one
+// instruction. All of them give the same results.
+struct board_kernels {
+    const char *name;
+    bool (*supported)(void);
+    uint8_t (*pop_count)(uint64_t bits);
+    uint64_t (*select_cell)(uint64_t cells, uint8_t n);
+    board_t (*pack)(uint8_t board[SIZE][SIZE]);
+    void (*unpack)(board_t packed, uint8_t board[SIZE][SIZE]);
+};
+
+// the kernels from fastest to slowest, the first supported one is used
+extern const struct board_kernels all_board_kernels[];
+extern const uint8_t board_kernel_count;
+
+// a packed board moved by the array engine, and by the one of the build
+bool arrayMove(board_t *board, uint8_t direction, uint32_t *score);
+bool engineMove(board_t *board, uint8_t direction, uint32_t *score);
+
+// Boards of the other sizes, from 3x3 up to 8x8, keep one byte per cell with
+// cell [x][y] at cells[n * x + y]: beyond 4x4 tiles quickly outgrow the 4
+// bits of the packed board. Every size has its own kernels, a game picks
+// them once when it starts.
+#define MIN_SIZE 3
+#define MAX_SIZE 8
+#define SIZED_KERNEL_COUNT (MAX_SIZE - MIN_SIZE + 1)
+
+struct sized_kernels {
+    uint8_t size;
+    bool (*move)(uint8_t *cells, uint8_t direction, uint32_t *score);
+    uint8_t (*count_empty)(const uint8_t *cells);
+    bool (*game_ended)(const uint8_t *cells);
+    void (*add_random)(uint8_t *cells, rng_t *rng);
+};
+
+// from MIN_SIZE up, 4x4 is there as well, the game plays it packed
+extern const struct sized_kernels all_sized_kernels[SIZED_KERNEL_COUNT];
+
+struct sized_game {
+    uint8_t cells[MAX_SIZE * MAX_SIZE];
+    uint32_t score;
+    rng_t rng;
+    const struct sized_kernels *kernels;
+};
+
+void sizedGameInit(struct sized_game *game, uint8_t size);
+
+// Batches of boards are stepped in lockstep for training bots: the boards,
+// their scores and the directions to move them in are separate arrays of the
+// same length. The results match bitboardMove bit for bit.
+struct batch_kernels {
+    const char *name;
+    bool (*supported)(void);
+    void (*move)(board_t *boards, uint32_t *scores, const uint8_t *directions,
+                 uint8_t *moved, uint32_t count);
+    void (*count_empty)(const board_t *boards, uint8_t *counts,
+                        uint32_t count);
+    void (*game_ended)(const board_t *boards, uint8_t *ended, uint32_t count);
+};
+
+// the kernels from fastest to slowest, the first supported one is used
+extern const struct batch_kernels all_batch_kernels[];
+extern const uint8_t batch_kernel_count;
+
+void moveBatch(board_t *boards, uint32_t *scores, const uint8_t *directions,
+               uint8_t *moved, uint32_t count);
+void countEmptyBatch(const board_t *boards, uint8_t *counts, uint32_t count);
+void gameEndedBatch(const board_t *boards, uint8_t *ended, uint32_t count);
+
+// A vector of games for training bots, that all take a step in one call: the
+// boards, the scores and the random states are arrays of their own, in one
+// allocation aligned for the batch kernels. A move that does not change the
+// board earns nothing and spawns no tile, and a game that ends starts over
+// right away, with its random state carrying on.
+struct env_batch {
+    uint32_t count;
+    board_t *boards;
+    rng_t *rngs;
+    uint32_t *scores; // of the games so far, 0 after a reset
+    uint8_t *moved;
+};
+
+// returns NULL when there is no memory for the games
+struct env_batch *newEnvBatch(uint32_t count);
+void freeEnvBatch(struct env_batch *batch);
+// starts every game anew, game i from seeds[i] as gameInit would
+void envReset(struct env_batch *batch, const uint64_t *seeds);
+// moves game i in direction actions[i], rewards[i] gets its points and
+// dones[i] whether the game ended and was reset
+void envStep(struct env_batch *batch, const uint8_t *actions,
+             uint32_t *rewards, uint8_t *dones);
+
+// An archive stores complete games for datasets, all numbers little endian:
+//   the header: "2048ARCH", uint32 version and uint32 moves per checkpoint,
+//   the games: uint64 seed, uint32 moves, uint32 final score, the moves at
+//   2 bits each (the first in the low bits) padded to 8 bytes, and after
+//   every checkpoint_moves moves the board, rng and 64-bit score they led to,
+//   the index: the uint64 offset of every game,
+//   the footer: uint64 offset of the index, uint64 games and "2048ARCH".
+// A game replays from its seed like gameInit, every move followed by a spawn.
+// The reader works on the archive in place, mapped or handed in memory.
+#define ARCHIVE_MAGIC "2048ARCH"
+#define ARCHIVE_VERSION 1
+#define ARCHIVE_HEADER 16
+#define ARCHIVE_RECORD 16
+#define ARCHIVE_CHECKPOINT 24
+#define ARCHIVE_FOOTER 24
+
+struct archive {
+    const uint8_t *data;
+    size_t size;
+    uint64_t games;
+    uint32_t checkpoint_moves; // 0 for none
+    const uint8_t *index;
+    bool mapped;
+};
+
+struct archive_game {
+    uint64_t seed;
+    uint32_t moves;
+    uint32_t score;
+    uint32_t checkpoint_moves;
+    const uint8_t *directions;
+    const uint8_t *checkpoints;
+};
+
+// false when the file or the data is no archive
+bool openArchive(struct archive *archive, const char *path);
+bool readArchive(struct archive *archive, const void *data, size_t size);
+void closeArchive(struct archive *archive);
+size_t archiveRecordSize(uint32_t moves, uint32_t checkpoint_moves);
+// points game at game i of the archive, false when it is out of bounds
+bool archiveGame(const struct archive *archive, uint64_t i,
+                 struct archive_game *game);
+uint8_t archiveMove(const struct archive_game *game, uint32_t j);
+// the state of the game after its first j moves, from the last checkpoint
+void archiveSeek(const struct archive_game *game, uint32_t j,
+                 struct game *state);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif